@@ -0,0 +1,591 @@
+/* Rope kept in a B+tree.
+ *
+ * Inserts split a full leaf or node in two and add the new half next to it,
+ * growing the tree at the root, as in any B+tree. Deletes drop emptied
+ * leaves and nodes, and merge a leaf left nearly empty into the next one,
+ * but do not rebalance inner nodes. Should that ever let the tree grow as
+ * deep as a path can go, it is rebuilt from its leaves. */
+
+#include "btreerope.h"
+#include "pool.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Leaves hold up to this many bytes. Inner nodes have up to
+ * BTREE_ROPE_FANOUT children. */
+#define BTREE_ROPE_LEAF_SIZE 1024
+#define BTREE_ROPE_FANOUT 32
+
+/* Levels of inner nodes a path can go through. */
+#define BTREE_ROPE_MAX_DEPTH 16
+
+typedef struct BTreeLeaf {
+    struct BTreeLeaf *prev, *next;
+    int len;
+    char text[BTREE_ROPE_LEAF_SIZE];
+} BTreeLeaf;
+
+/* ends[i] is where the text under children[i] ends, counting from the start
+ * of the node: the lengths of the children up to it, summed. A descent then
+ * finds its child by counting the ends before its position, with no branch
+ * on the data, which compilers turn into vector compares. The children of
+ * the nodes on the lowest level are leaves, and the rest are nodes. */
+typedef struct {
+    int count;
+    int ends[BTREE_ROPE_FANOUT];
+    void *children[BTREE_ROPE_FANOUT];
+} BTreeNode;
+
+/* height is the number of levels of inner nodes, so the root is a leaf when
+ * it is zero. The empty rope has no root at all. first is the first leaf. */
+struct BTreeRope {
+    void *root;
+    int height;
+    int size;
+    BTreeLeaf *first;
+    Pool *nodes;
+    Pool *leaves;
+};
+
+/* A node on the way down to a leaf, and which of its children was taken. */
+typedef struct {
+    BTreeNode *node;
+    int index;
+} PathStep;
+
+static BTreeLeaf *newLeaf(BTreeRope *self, const char *text, int len);
+static void *buildLevels(Pool *nodes, void **level, int *sizes, int n,
+                         int *height);
+static int rebuild(BTreeRope *self);
+static BTreeLeaf *descend(const BTreeRope *self, int *pos, int at_end,
+                          PathStep *path);
+static int insertChunk(BTreeRope *self, int pos, const char *text, int len);
+static int allocSpares(BTreeRope *self, const PathStep *path, void **spares);
+static void splitLeaf(BTreeLeaf *leaf, BTreeLeaf *right, int pos,
+                      const char *text, int len);
+static void insertChild(BTreeNode *node, BTreeNode *right, int at,
+                        void *child, int size);
+static void removeChild(BTreeNode *node, int at);
+static void growChild(BTreeNode *node, int i, int delta);
+static int childSize(const BTreeNode *node, int i);
+static int deleteInLeaf(BTreeRope *self, int pos, int len);
+static void mergeNext(BTreeRope *self, BTreeNode *node, int i);
+static void linkAfter(BTreeLeaf *leaf, BTreeLeaf *right);
+static void unlinkLeaf(BTreeRope *self, BTreeLeaf *leaf);
+static int nodeSize(const BTreeNode *node);
+
+BTreeRope *BTreeRope_new() {
+    BTreeRope *self = malloc(sizeof(BTreeRope));
+    if (!self) return NULL;
+
+    *self = (BTreeRope) {
+        .root = NULL, .height = 0, .size = 0, .first = NULL,
+        .nodes = Pool_new(sizeof(BTreeNode)),
+        .leaves = Pool_new(sizeof(BTreeLeaf))
+    };
+    if (!self->nodes || !self->leaves) {
+        BTreeRope_destroy(self);
+        return NULL;
+    }
+    return self;
+}
+
+BTreeRope *BTreeRope_buildFrom(const char *buf, int len) {
+    if (len < 0) return NULL;
+
+    BTreeRope *self = BTreeRope_new();
+    if (!self || (len == 0)) return self;
+
+    int n = (len + BTREE_ROPE_LEAF_SIZE - 1) / BTREE_ROPE_LEAF_SIZE;
+    void **level = malloc(n * sizeof(void *));
+    int *sizes = malloc(n * sizeof(int));
+    if (!level || !sizes) goto error;
+
+    BTreeLeaf *last = NULL;
+    for (int i = 0; i < n; i++) {
+        int offset = i * BTREE_ROPE_LEAF_SIZE;
+        int leaf_len = (len - offset < BTREE_ROPE_LEAF_SIZE) ?
+            len - offset : BTREE_ROPE_LEAF_SIZE;
+
+        BTreeLeaf *leaf = newLeaf(self, buf + offset, leaf_len);
+        if (!leaf) goto error;
+        if (last)
+            linkAfter(last, leaf);
+        else
+            self->first = leaf;
+        last = leaf;
+
+        level[i] = leaf;
+        sizes[i] = leaf_len;
+    }
+
+    self->root = buildLevels(self->nodes, level, sizes, n, &(self->height));
+    if (!self->root) goto error;
+    self->size = len;
+
+    free(level);
+    free(sizes);
+    return self;
+
+error:
+    /* Whatever was allocated goes away with the pools. */
+    free(level);
+    free(sizes);
+    BTreeRope_destroy(self);
+    return NULL;
+}
+
+void BTreeRope_destroy(BTreeRope *self) {
+    if (!self) return;
+
+    /* Every node and leaf goes away with its pool, so the tree is not
+     * walked. */
+    if (self->nodes) Pool_destroy(self->nodes);
+    if (self->leaves) Pool_destroy(self->leaves);
+    free(self);
+}
+
+BTreeRope *BTreeRope_insert(BTreeRope *self, int pos, const char *text) {
+    if (pos < 0) pos += self->size + 1;
+    if ((pos < 0) || (pos > self->size)) return NULL;
+
+    int len = strlen(text);
+    while (len > 0) {
+        int n = (len < BTREE_ROPE_LEAF_SIZE) ? len : BTREE_ROPE_LEAF_SIZE;
+        if (insertChunk(self, pos, text, n)) return NULL;
+        pos += n;
+        text += n;
+        len -= n;
+    }
+    return self;
+}
+
+BTreeRope *BTreeRope_delete(BTreeRope *self, int begin, int end) {
+    if (begin < 0) begin += self->size + 1;
+    if (end < 0) end += self->size + 1;
+
+    if ((begin < 0) || (end < 0) || (begin > end)) return NULL;
+    if (end > self->size) return NULL;
+
+    /* A leaf at a time, as the range may span any number of them. */
+    while (end > begin) end -= deleteInLeaf(self, begin, end - begin);
+    return self;
+}
+
+int BTreeRope_size(const BTreeRope *self) {
+    return self->size;
+}
+
+char *BTreeRope_toString(const BTreeRope *self) {
+    char *s = malloc(self->size + 1);
+    if (!s) return NULL;
+
+    BTreeRopeIter it;
+    const char *text;
+    int len;
+    char *dest = s;
+
+    BTreeRope_iterBegin(self, &it);
+    while (BTreeRope_iterNext(&it, &text, &len)) {
+        memcpy(dest, text, len);
+        dest += len;
+    }
+    *dest = '\0';
+    return s;
+}
+
+void BTreeRope_iterBegin(const BTreeRope *self, BTreeRopeIter *it) {
+    it->leaf = self->first;
+}
+
+int BTreeRope_iterNext(BTreeRopeIter *it, const char **text, int *len) {
+    if (!it->leaf) return 0;
+
+    *text = it->leaf->text;
+    *len = it->leaf->len;
+    it->leaf = it->leaf->next;
+    return 1;
+}
+
+static BTreeLeaf *newLeaf(BTreeRope *self, const char *text, int len) {
+    BTreeLeaf *leaf = Pool_alloc(self->leaves);
+    if (!leaf) return NULL;
+
+    leaf->prev = leaf->next = NULL;
+    leaf->len = len;
+    memcpy(leaf->text, text, len);
+    return leaf;
+}
+
+/* Builds the levels of inner nodes over the n leaves in level, whose lengths
+ * are in sizes, packing as many children in each node as it takes. Both
+ * arrays are used as scratch space.
+ *
+ * On success, the root is returned and height is set. On error, NULL is
+ * returned; the nodes allocated so far are left in the pool. */
+static void *buildLevels(Pool *nodes, void **level, int *sizes, int n,
+                         int *height) {
+    *height = 0;
+    while (n > 1) {
+        int m = (n + BTREE_ROPE_FANOUT - 1) / BTREE_ROPE_FANOUT;
+
+        /* Node j only reads entries from j on, so it can be stored at j. */
+        for (int j = 0; j < m; j++) {
+            BTreeNode *node = Pool_alloc(nodes);
+            if (!node) return NULL;
+
+            int first = j * BTREE_ROPE_FANOUT;
+            node->count = (n - first < BTREE_ROPE_FANOUT) ?
+                n - first : BTREE_ROPE_FANOUT;
+            memcpy(node->children, level + first,
+                   node->count * sizeof(void *));
+            int end = 0;
+            for (int k = 0; k < node->count; k++) {
+                end += sizes[first + k];
+                node->ends[k] = end;
+            }
+
+            level[j] = node;
+            sizes[j] = end;
+        }
+        n = m;
+        (*height)++;
+    }
+    return level[0];
+}
+
+/* Builds the inner levels of self anew over its leaves, with every node full.
+ *
+ * On success, zero is returned. On error, -1 is returned and self is left
+ * unchanged. */
+static int rebuild(BTreeRope *self) {
+    int n = 0;
+    for (BTreeLeaf *leaf = self->first; leaf; leaf = leaf->next) n++;
+
+    void **level = malloc(n * sizeof(void *));
+    int *sizes = malloc(n * sizeof(int));
+    Pool *nodes = Pool_new(sizeof(BTreeNode));
+    if (!level || !sizes || !nodes) goto error;
+
+    int i = 0;
+    for (BTreeLeaf *leaf = self->first; leaf; leaf = leaf->next, i++) {
+        level[i] = leaf;
+        sizes[i] = leaf->len;
+    }
+
+    int height;
+    void *root = buildLevels(nodes, level, sizes, n, &height);
+    if (!root) goto error;
+
+    /* The old inner nodes all go at once with their pool. */
+    Pool_destroy(self->nodes);
+    self->nodes = nodes;
+    self->root = root;
+    self->height = height;
+
+    free(level);
+    free(sizes);
+    return 0;
+
+error:
+    if (nodes) Pool_destroy(nodes);
+    free(level);
+    free(sizes);
+    return -1;
+}
+
+/* Descends from the root to the leaf that holds pos, filling path with the
+ * nodes on the way, and sets pos to its offset inside that leaf.
+ *
+ * Where two children meet, pos is taken to be at the end of the left one if
+ * at_end is set, as inserts want, and at the start of the right one
+ * otherwise. */
+static BTreeLeaf *descend(const BTreeRope *self, int *pos, int at_end,
+                          PathStep *path) {
+    void *node = self->root;
+    for (int level = 0; level < self->height; level++) {
+        BTreeNode *inner = node;
+
+        /* The child is the one after every end that pos is past, or at,
+         * unless at_end is set. The last child takes whatever is left. */
+        int key = *pos - at_end;
+        int i = 0;
+        for (int j = 0; j < inner->count - 1; j++)
+            i += (inner->ends[j] <= key);
+        if (i > 0) *pos -= inner->ends[i - 1];
+
+        path[level] = (PathStep) { .node = inner, .index = i };
+        node = inner->children[i];
+    }
+    return node;
+}
+
+/* Inserts text, which must fit in a leaf, at pos.
+ *
+ * On success, zero is returned. On error, -1 is returned and self is left
+ * unchanged. */
+static int insertChunk(BTreeRope *self, int pos, const char *text, int len) {
+    if (!self->root) {
+        BTreeLeaf *leaf = newLeaf(self, text, len);
+        if (!leaf) return -1;
+
+        self->root = self->first = leaf;
+        self->size = len;
+        return 0;
+    }
+
+    /* Leave room for a split at every level. */
+    if ((self->height >= BTREE_ROPE_MAX_DEPTH - 1) && rebuild(self))
+        return -1;
+
+    PathStep path[BTREE_ROPE_MAX_DEPTH];
+    BTreeLeaf *leaf = descend(self, &pos, 1, path);
+
+    void *spares[BTREE_ROPE_MAX_DEPTH + 2];
+    int spare = 0;
+    if ((leaf->len + len > BTREE_ROPE_LEAF_SIZE) &&
+            (allocSpares(self, path, spares) == -1))
+        return -1;
+
+    /* sibling is the new right half of the child just handled, if it was
+     * split, which goes next to it in the level above. */
+    void *sibling = NULL;
+    int sibling_size = 0;
+    if (leaf->len + len <= BTREE_ROPE_LEAF_SIZE) {
+        memmove(leaf->text + pos + len, leaf->text + pos, leaf->len - pos);
+        memcpy(leaf->text + pos, text, len);
+        leaf->len += len;
+    } else {
+        BTreeLeaf *right = spares[spare++];
+        splitLeaf(leaf, right, pos, text, len);
+        linkAfter(leaf, right);
+        sibling = right;
+        sibling_size = right->len;
+    }
+
+    int child_size = leaf->len;
+    for (int level = self->height - 1; level >= 0; level--) {
+        BTreeNode *node = path[level].node;
+        int i = path[level].index;
+
+        growChild(node, i, child_size - childSize(node, i));
+        if (sibling) {
+            BTreeNode *right = (node->count == BTREE_ROPE_FANOUT) ?
+                spares[spare++] : NULL;
+            insertChild(node, right, i + 1, sibling, sibling_size);
+            sibling = right;
+            sibling_size = right ? nodeSize(right) : 0;
+        }
+        child_size = nodeSize(node);
+    }
+
+    /* The root itself was split. */
+    if (sibling) {
+        BTreeNode *root = spares[spare++];
+        *root = (BTreeNode) {
+            .count = 2,
+            .ends = { child_size, child_size + sibling_size },
+            .children = { self->root, sibling }
+        };
+        self->root = root;
+        self->height++;
+    }
+
+    self->size += len;
+    return 0;
+}
+
+/* Allocates, before anything is changed, what an insert that overflows the
+ * leaf at the end of path needs: a leaf for its right half, a node for each
+ * full node above it, which is split in turn, and a new root if they all
+ * are.
+ *
+ * On success, zero is returned and spares holds them, in the order they are
+ * used. On error, -1 is returned. */
+static int allocSpares(BTreeRope *self, const PathStep *path, void **spares) {
+    int n = 0;
+    spares[n++] = Pool_alloc(self->leaves);
+
+    int level = self->height - 1;
+    while ((level >= 0) && (path[level].node->count == BTREE_ROPE_FANOUT)) {
+        spares[n++] = Pool_alloc(self->nodes);
+        level--;
+    }
+    if (level < 0) spares[n++] = Pool_alloc(self->nodes);
+
+    int failed = 0;
+    for (int i = 0; i < n; i++) failed |= !spares[i];
+    if (!failed) return 0;
+
+    for (int i = 0; i < n; i++) {
+        if (!spares[i]) continue;
+        Pool_free((i == 0) ? self->leaves : self->nodes, spares[i]);
+    }
+    return -1;
+}
+
+/* Inserts text at pos of leaf, which then overflows, sharing the result
+ * with the empty leaf right. Both end up half full, unless text goes at the
+ * end of leaf: then leaf is filled, as more text likely follows it. */
+static void splitLeaf(BTreeLeaf *leaf, BTreeLeaf *right, int pos,
+                      const char *text, int len) {
+    char buf[2 * BTREE_ROPE_LEAF_SIZE];
+    int total = leaf->len + len;
+
+    memcpy(buf, leaf->text, pos);
+    memcpy(buf + pos, text, len);
+    memcpy(buf + pos + len, leaf->text + pos, leaf->len - pos);
+
+    int l_len = (pos == leaf->len) ? BTREE_ROPE_LEAF_SIZE : total / 2;
+    memcpy(leaf->text, buf, l_len);
+    leaf->len = l_len;
+    memcpy(right->text, buf + l_len, total - l_len);
+    right->len = total - l_len;
+}
+
+/* Inserts child, whose text is size bytes long, at position at of node.
+ *
+ * If node is full, right must be an unused node: the upper half of the
+ * children of node is moved to it first, and child goes to whichever half
+ * at falls in. */
+static void insertChild(BTreeNode *node, BTreeNode *right, int at,
+                        void *child, int size) {
+    if (right) {
+        int half = BTREE_ROPE_FANOUT / 2;
+        right->count = BTREE_ROPE_FANOUT - half;
+        for (int i = 0; i < right->count; i++)
+            right->ends[i] = node->ends[half + i] - node->ends[half - 1];
+        memcpy(right->children, node->children + half,
+               right->count * sizeof(void *));
+        node->count = half;
+
+        if (at > half) {
+            node = right;
+            at -= half;
+        }
+    }
+
+    memmove(node->ends + at + 1, node->ends + at,
+            (node->count - at) * sizeof(int));
+    memmove(node->children + at + 1, node->children + at,
+            (node->count - at) * sizeof(void *));
+    node->ends[at] = (at > 0) ? node->ends[at - 1] : 0;
+    node->children[at] = child;
+    node->count++;
+    growChild(node, at, size);
+}
+
+static void removeChild(BTreeNode *node, int at) {
+    int size = childSize(node, at);
+    node->count--;
+    memmove(node->ends + at, node->ends + at + 1,
+            (node->count - at) * sizeof(int));
+    memmove(node->children + at, node->children + at + 1,
+            (node->count - at) * sizeof(void *));
+    growChild(node, at, -size);
+}
+
+/* Adds delta to the length of child i of node, which moves the end of every
+ * child from it on. */
+static void growChild(BTreeNode *node, int i, int delta) {
+    for (int j = i; j < node->count; j++) node->ends[j] += delta;
+}
+
+static int childSize(const BTreeNode *node, int i) {
+    return node->ends[i] - ((i > 0) ? node->ends[i - 1] : 0);
+}
+
+/* Deletes up to len bytes from pos on, as long as they are in the leaf that
+ * holds pos.
+ *
+ * Returns how many bytes were deleted. */
+static int deleteInLeaf(BTreeRope *self, int pos, int len) {
+    PathStep path[BTREE_ROPE_MAX_DEPTH];
+    BTreeLeaf *leaf = descend(self, &pos, 0, path);
+
+    int n = leaf->len - pos;
+    if (n > len) n = len;
+    memmove(leaf->text + pos, leaf->text + pos + n, leaf->len - pos - n);
+    leaf->len -= n;
+    self->size -= n;
+
+    /* An emptied leaf is dropped, along with the nodes left without
+     * children because of it. */
+    int emptied = (leaf->len == 0);
+    int removing = emptied;
+    if (emptied) {
+        unlinkLeaf(self, leaf);
+        Pool_free(self->leaves, leaf);
+    }
+
+    for (int level = self->height - 1; level >= 0; level--) {
+        BTreeNode *node = path[level].node;
+        int i = path[level].index;
+        if (!removing) {
+            growChild(node, i, -n);
+            continue;
+        }
+
+        removeChild(node, i);
+        removing = (node->count == 0);
+        if (removing) Pool_free(self->nodes, node);
+    }
+
+    if (removing) {
+        self->root = NULL;
+        self->height = 0;
+        return n;
+    }
+
+    if (!emptied && (self->height > 0))
+        mergeNext(self, path[self->height - 1].node,
+                  path[self->height - 1].index);
+
+    /* A root with a single child is not needed. */
+    while ((self->height > 0) && (((BTreeNode *) self->root)->count == 1)) {
+        BTreeNode *root = self->root;
+        self->root = root->children[0];
+        self->height--;
+        Pool_free(self->nodes, root);
+    }
+    return n;
+}
+
+/* Moves the text of child i + 1 of node, a leaf, at the end of child i, if
+ * that one is under a quarter full and both fit in one. */
+static void mergeNext(BTreeRope *self, BTreeNode *node, int i) {
+    BTreeLeaf *leaf = node->children[i];
+    if ((leaf->len >= BTREE_ROPE_LEAF_SIZE / 4) || (i + 1 == node->count))
+        return;
+
+    BTreeLeaf *next = node->children[i + 1];
+    if (leaf->len + next->len > BTREE_ROPE_LEAF_SIZE) return;
+
+    memcpy(leaf->text + leaf->len, next->text, next->len);
+    leaf->len += next->len;
+
+    removeChild(node, i + 1);
+    growChild(node, i, next->len);
+    unlinkLeaf(self, next);
+    Pool_free(self->leaves, next);
+}
+
+static void linkAfter(BTreeLeaf *leaf, BTreeLeaf *right) {
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (leaf->next) leaf->next->prev = right;
+    leaf->next = right;
+}
+
+static void unlinkLeaf(BTreeRope *self, BTreeLeaf *leaf) {
+    if (leaf->prev)
+        leaf->prev->next = leaf->next;
+    else
+        self->first = leaf->next;
+    if (leaf->next) leaf->next->prev = leaf->prev;
+}
+
+/* Returns the length of the text under node, where its last child ends. */
+static int nodeSize(const BTreeNode *node) {
+    return (node->count > 0) ? node->ends[node->count - 1] : 0;
+}
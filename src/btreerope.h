@@ -0,0 +1,58 @@
+/* Rope shaped like a B+tree. Inner nodes have dozens of children, and keep
+ * the length of each in a packed array, so a level of a descent is a scan
+ * over a cache line or two instead of a pointer chase per binary level. The
+ * text lives in the leaves only, which are linked in order.
+ *
+ * It offers the editing operations of rope.h, with the same semantics, so
+ * that both shapes of tree can be compared on the same workloads. Only those
+ * are offered: it is a prototype for test/BENCH_rope.c, and the server cannot
+ * be built on it. */
+
+#ifndef BTREEROPE_H
+#define BTREEROPE_H
+
+typedef struct BTreeRope BTreeRope;
+
+/* Walks over the text of a B+tree rope, one leaf at a time, without copying
+ * it. */
+typedef struct {
+    const struct BTreeLeaf *leaf;
+} BTreeRopeIter;
+
+/* Creates a new empty B+tree rope.
+ *
+ * On success, a pointer to the newly created rope is returned. On error,
+ * NULL is returned. */
+BTreeRope *BTreeRope_new();
+
+/* Creates a new B+tree rope holding the first len bytes of buf, which need
+ * not be null-terminated. buf is cut in full leaves, and the levels above
+ * them are built bottom up, with every node full but the last of each level.
+ *
+ * On success, a pointer to the newly created rope is returned. On error,
+ * NULL is returned. */
+BTreeRope *BTreeRope_buildFrom(const char *buf, int len);
+
+void BTreeRope_destroy(BTreeRope *self);
+
+/* Same as Rope_insert and Rope_delete.
+ *
+ * On success, self is returned. If a position is out of range, NULL is
+ * returned and self is left unchanged. If memory runs out, NULL is returned
+ * too; text longer than a leaf is inserted a leaf at a time, and may then
+ * be inserted only in part. */
+BTreeRope *BTreeRope_insert(BTreeRope *self, int pos, const char *text);
+BTreeRope *BTreeRope_delete(BTreeRope *self, int begin, int end);
+
+/* Returns the length of the text held by self, in constant time. */
+int BTreeRope_size(const BTreeRope *self);
+
+/* Returns the contents of self as a null-terminated string, obtained with
+ * malloc. On error, NULL is returned. */
+char *BTreeRope_toString(const BTreeRope *self);
+
+/* Same as Rope_iterBegin and Rope_iterNext. */
+void BTreeRope_iterBegin(const BTreeRope *self, BTreeRopeIter *it);
+int BTreeRope_iterNext(BTreeRopeIter *it, const char **text, int *len);
+
+#endif
@@ -9,9 +9,19 @@
 #include "socket.h"
 
 #include "courier.h"
+#include "delta.h"
 #include <stdio.h>
+#include <stdlib.h>
 
-static void clientLoop(socket_t *sock);
+/* The text of the document as last received with DELTA_PRINT. */
+struct mirror_s {
+    char *text;
+    int len;
+};
+
+static int clientLoop(socket_t *sock, int hello);
+static int expectsResponse(const Courier *courier, int opcode);
+static void printDelta(Courier *courier, struct mirror_s *mirror);
 
 void clientRoutine(int argc, char **argv) {
     if ((argc < 4) || (argc > 5)) { printHelp(); return; }
@@ -25,22 +35,44 @@ void clientRoutine(int argc, char **argv) {
     if (socket_create(&sock) || socket_connect(&sock, argv[2], portNumber))
         goto closeInput;
 
-    clientLoop(&sock);
+    if (clientLoop(&sock, 1)) {
+        /* A server that only speaks version 1 hangs up on the hello, so the
+         * session starts over without it. */
+        socket_destroy(&sock);
+        if (socket_create(&sock) ||
+                socket_connect(&sock, argv[2], portNumber) ||
+                clientLoop(&sock, 0))
+            fprintf(stderr, "Could not start a session with the server\n");
+    }
 
     socket_destroy(&sock);
 closeInput:
     fclose(stdin);
 }
 
-static void clientLoop(socket_t *sock) {
+/* Runs the commands read from stdin, after agreeing on the latest version
+ * of the wire format if hello is set.
+ *
+ * On success, 0 is returned. If the session could not be started, nothing
+ * is read, and -1 is returned. */
+static int clientLoop(socket_t *sock, int hello) {
     Courier *courier = Courier_new(sock);
+    if (!courier) return -1;
+    if (hello && Courier_hello(courier)) {
+        Courier_destroy(courier);
+        return -1;
+    }
+
+    struct mirror_s mirror = { .text=NULL, .len=0 };
     do {
         struct command_s command = Courier_readCommand(courier);
 
         if (command.opcode < 1) break;
 
         Courier_sendCommand(courier, command);
-        if (command.opcode == COURIER_PRINT) {
+        if (command.opcode == COURIER_DELTA_PRINT) {
+            printDelta(courier, &mirror);
+        } else if (expectsResponse(courier, command.opcode)) {
             struct response_s response = Courier_recvResponse(courier);
             printf("%s", response.data);
             Courier_destroyResponse(response);
@@ -49,5 +81,43 @@ static void clientLoop(socket_t *sock) {
         Courier_destroyCommand(command);
     } while (1);
 
+    free(mirror.text);
     Courier_destroy(courier);
+    return 0;
+}
+
+static int expectsResponse(const Courier *courier, int opcode) {
+    switch (opcode) {
+        case COURIER_LOAD:
+            return Courier_version(courier) >= 2;
+        case COURIER_PRINT:
+        case COURIER_LINE_PRINT:
+        case COURIER_LINES:
+        case COURIER_SEARCH:
+        case COURIER_HASH:
+        case COURIER_PRINT_RANGE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* Receives the changes to the document since the last DELTA_PRINT, applies
+ * them to mirror, and prints the whole of it, as PRINT would. */
+static void printDelta(Courier *courier, struct mirror_s *mirror) {
+    struct response_s response = Courier_recvResponse(courier);
+    if (response.len < 0) return;
+
+    int len;
+    char *text = Delta_apply(mirror->text ? mirror->text : "", mirror->len,
+                             response.data, response.len, &len);
+    Courier_destroyResponse(response);
+    if (!text) {
+        fprintf(stderr, "Could not apply the changes received\n");
+        return;
+    }
+
+    free(mirror->text);
+    *mirror = (struct mirror_s){ .text=text, .len=len };
+    printf("%s", text);
 }
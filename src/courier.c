@@ -10,27 +10,106 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <limits.h> //USHRT_MAX
+#include <limits.h> //INT_MAX
 
-#define INSERT_MAX_SIZE (USHRT_MAX + 1)
+#define INSERT_MAX_SIZE (COURIER_MAX_STRING_V1 + 1)
+#define RESPONSE_IOV_MAX 64
+#define OUTPUT_SIZE 16384
+#define INPUT_SIZE 16384
+#define VARINT_MAX 5
+#define MESSAGE_HEAD_SIZE 32
+#define MESSAGE_PARTS_MAX 8
+#define LOAD_PATH_SIZE 4096
 
 static void readPrint(struct command_s *in);
 static void readSpace(struct command_s *in);
 static void readNewline(struct command_s *in);
 static void readInsert(struct command_s *in);
 static void readDelete(struct command_s *in);
-
-static int sendLong(Courier *self, int l);
-static int sendShort(Courier *self, short int s);
-static int sendString(Courier *self, short int len, char *buf);
-static int sendLongString(Courier *self, int len, char *buf);
-
+static void readHistory(struct command_s *in, int opcode);
+static void readLineInsert(struct command_s *in);
+static void readLineDelete(struct command_s *in);
+static void readLinePrint(struct command_s *in);
+static void readLines(struct command_s *in);
+static void readLoad(struct command_s *in);
+static void readSearch(struct command_s *in);
+static void readReplace(struct command_s *in);
+static void readAddressing(struct command_s *in);
+static void readHash(struct command_s *in);
+static void readPrintRange(struct command_s *in);
+static void readDeltaPrint(struct command_s *in);
+
+struct message_s;
+
+static int negotiate(Courier *self);
+static void putLong(struct message_s *m, int l);
+static void putPosition(struct message_s *m, int *last, int pos);
+static void putString(struct message_s *m, int len, const char *buf);
+static void putLongString(struct message_s *m, int len, const char *buf);
+static void putPart(struct message_s *m, const void *data, int len);
+static int sendMessage(Courier *self, const struct message_s *m);
+static int bufferOut(Courier *self, const void *data, int len);
+static int encodeVarint(unsigned int value, char *dest);
+
+static int hasBufferedCommand(const Courier *self);
+static int recvBytes(Courier *self, void *dest, int len);
+static int recvPayload(Courier *self, void *dest, int len);
+static int recvVarint(Courier *self, unsigned int *value, int framed);
 static int recvLong(Courier *self, int *l);
-static int recvShort(Courier *self, short int *s);
-static int recvString(Courier *self, short int *len, char **buf);
+static int recvPosition(Courier *self, int *pos);
+static int recvString(Courier *self, int *len, char **buf);
 static int recvLongString(Courier *self, int *len, char **buf);
 
-struct Courier { socket_t *socket; };
+/* How each command is laid out after its opcode: this many longs, then this
+ * many strings. */
+struct layout_s { int longs; int strings; };
+static const struct layout_s LAYOUTS[] = {
+    [COURIER_INSERT] = {1, 1}, [COURIER_DELETE] = {2, 0},
+    [COURIER_SPACE] = {1, 0}, [COURIER_NEWLINE] = {1, 0},
+    [COURIER_PRINT] = {0, 0}, [COURIER_CHECKPOINT] = {0, 0},
+    [COURIER_UNDO] = {0, 0}, [COURIER_REDO] = {0, 0},
+    [COURIER_LINE_INSERT] = {2, 1}, [COURIER_LINE_DELETE] = {4, 0},
+    [COURIER_LINE_PRINT] = {2, 0}, [COURIER_LINES] = {0, 0},
+    [COURIER_LOAD] = {0, 1}, [COURIER_SEARCH] = {1, 1},
+    [COURIER_REPLACE] = {0, 2}, [COURIER_ADDRESSING] = {1, 0},
+    [COURIER_HASH] = {2, 0}, [COURIER_PRINT_RANGE] = {2, 0},
+    [COURIER_HELLO] = {1, 0}, [COURIER_DELTA_PRINT] = {0, 0}
+};
+
+/* A message being encoded: a command or a response. Numbers are encoded into
+ * head, while the strings carried are only pointed to, so that every part is
+ * copied once, into the output buffer or straight into the socket. failed is
+ * set when the message cannot be encoded in its version. */
+struct message_s {
+    int version;
+    char head[MESSAGE_HEAD_SIZE];
+    int head_len;
+    struct iovec parts[MESSAGE_PARTS_MAX];
+    int n_parts;
+    int len;
+    int failed;
+};
+
+/* Whatever is sent is encoded into output, which only goes out on the socket
+ * when it is flushed. Whatever is received is read into input as it comes,
+ * as much as fits at a time, and decoded from there; the bytes not decoded
+ * yet are those in [input_begin, input_end).
+ *
+ * In version 2, each flush of output goes out as a frame: its length, as a
+ * varint, and then the messages it holds, which are never cut between two
+ * frames. frame_left is what is left to decode of the frame being read.
+ * Positions are sent as the difference from the previous one, which is kept
+ * in sent_position and received_position on each end. */
+struct Courier {
+    socket_t *socket;
+    int version;
+    char output[OUTPUT_SIZE];
+    int output_len;
+    char input[INPUT_SIZE];
+    int input_begin, input_end;
+    int frame_left;
+    int sent_position, received_position;
+};
 
 Courier *Courier_new(socket_t *socket) {
     if (!socket || (socket->socket < 0)) return NULL;
@@ -38,17 +117,37 @@ Courier *Courier_new(socket_t *socket) {
     Courier *self = malloc(sizeof(Courier));
     if (!self) return NULL;
 
-    *self = (Courier){ .socket=socket };
+    *self = (Courier){
+        .socket=socket, .version=1, .output_len=0, .input_begin=0,
+        .input_end=0, .frame_left=0, .sent_position=0, .received_position=0
+    };
+
+    /* Writes are already gathered here, so there is nothing for Nagle's
+     * algorithm to gain by holding them back. */
+    socket_set_nodelay(socket, 1);
     return self;
 }
 
 void Courier_destroy(Courier *self) {
+    if (!self) return;
+
+    Courier_flush(self);
     free(self);
 }
 
 void Courier_destroyCommand(struct command_s self) {
-    if ((self.opcode == 1) && (self.u.i.data))
+    if ((self.opcode == COURIER_INSERT) && (self.u.i.data))
         free(self.u.i.data);
+    if ((self.opcode == COURIER_LINE_INSERT) && (self.u.li.data))
+        free(self.u.li.data);
+    if ((self.opcode == COURIER_LOAD) && (self.u.l.path))
+        free(self.u.l.path);
+    if ((self.opcode == COURIER_SEARCH) && (self.u.f.data))
+        free(self.u.f.data);
+    if (self.opcode == COURIER_REPLACE) {
+        free(self.u.r.from);
+        free(self.u.r.to);
+    }
 }
 
 void Courier_destroyResponse(struct response_s self) {
@@ -56,6 +155,25 @@ void Courier_destroyResponse(struct response_s self) {
         free(self.data);
 }
 
+int Courier_version(const Courier *self) {
+    return self->version;
+}
+
+int Courier_hello(Courier *self) {
+    struct message_s m = { .version=self->version };
+    putLong(&m, COURIER_HELLO);
+    putLong(&m, COURIER_VERSION);
+
+    int version;
+    if (sendMessage(self, &m) || Courier_flush(self) ||
+            recvLong(self, &version))
+        return -1;
+    if ((version < 1) || (version > COURIER_VERSION)) return -1;
+
+    self->version = version;
+    return 0;
+}
+
 struct command_s Courier_readCommand(Courier *self) {
     struct command_s ret = { .opcode=0 };
 
@@ -78,6 +196,34 @@ struct command_s Courier_readCommand(Courier *self) {
         readInsert(&ret);
     } else if (strcmp("delete", s) == 0) {
         readDelete(&ret);
+    } else if (strcmp("checkpoint", s) == 0) {
+        readHistory(&ret, COURIER_CHECKPOINT);
+    } else if (strcmp("undo", s) == 0) {
+        readHistory(&ret, COURIER_UNDO);
+    } else if (strcmp("redo", s) == 0) {
+        readHistory(&ret, COURIER_REDO);
+    } else if (strcmp("linsert", s) == 0) {
+        readLineInsert(&ret);
+    } else if (strcmp("ldelete", s) == 0) {
+        readLineDelete(&ret);
+    } else if (strcmp("lprint", s) == 0) {
+        readLinePrint(&ret);
+    } else if (strcmp("lines", s) == 0) {
+        readLines(&ret);
+    } else if (strcmp("load", s) == 0) {
+        readLoad(&ret);
+    } else if (strcmp("search", s) == 0) {
+        readSearch(&ret);
+    } else if (strcmp("replace", s) == 0) {
+        readReplace(&ret);
+    } else if (strcmp("addressing", s) == 0) {
+        readAddressing(&ret);
+    } else if (strcmp("hash", s) == 0) {
+        readHash(&ret);
+    } else if (strcmp("rprint", s) == 0) {
+        readPrintRange(&ret);
+    } else if (strcmp("dprint", s) == 0) {
+        readDeltaPrint(&ret);
     } else {
         fprintf(stderr, "Unknown command: %s", s);
         ret = (struct command_s){ .opcode=-1 };
@@ -88,33 +234,102 @@ struct command_s Courier_readCommand(Courier *self) {
 struct command_s Courier_recvCommand(Courier *self) {
     struct command_s command;
 
-    if (recvLong(self, &(command.opcode)) == -1) {
+    if (Courier_flush(self) || (recvLong(self, &(command.opcode)) == -1)) {
         command = (struct command_s){ .opcode=0 };
         return command;
     }
 
+    if ((command.opcode == COURIER_HELLO) && (self->version == 1)) {
+        if (negotiate(self)) return (struct command_s){ .opcode=-1 };
+        return Courier_recvCommand(self);
+    }
+
     switch (command.opcode) {
         case COURIER_INSERT:
             if (
-                    recvLong(self, &(command.u.i.pos)) ||
+                    recvPosition(self, &(command.u.i.pos)) ||
                     recvString(self, &(command.u.i.len), &(command.u.i.data))
             ) command = (struct command_s){ .opcode=-1 };
             break;
         case COURIER_DELETE:
             if (
-                    recvLong(self, &(command.u.d.from)) ||
-                    recvLong(self, &(command.u.d.to))
+                    recvPosition(self, &(command.u.d.from)) ||
+                    recvPosition(self, &(command.u.d.to))
             ) command = (struct command_s){ .opcode=-1 };
             break;
         case COURIER_SPACE:
-            if (recvLong(self, &(command.u.s.pos)))
+            if (recvPosition(self, &(command.u.s.pos)))
                 command = (struct command_s){ .opcode=-1 };
             break;
         case COURIER_NEWLINE:
-            if (recvLong(self, &(command.u.n.pos)))
+            if (recvPosition(self, &(command.u.n.pos)))
                 command = (struct command_s){ .opcode=-1 };
             break;
+        case COURIER_LINE_INSERT:
+            if (
+                    recvLong(self, &(command.u.li.line)) ||
+                    recvLong(self, &(command.u.li.column)) ||
+                    recvString(self, &(command.u.li.len),
+                               &(command.u.li.data))
+            ) command = (struct command_s){ .opcode=-1 };
+            break;
+        case COURIER_LINE_DELETE:
+            if (
+                    recvLong(self, &(command.u.ld.from_line)) ||
+                    recvLong(self, &(command.u.ld.from_column)) ||
+                    recvLong(self, &(command.u.ld.to_line)) ||
+                    recvLong(self, &(command.u.ld.to_column))
+            ) command = (struct command_s){ .opcode=-1 };
+            break;
+        case COURIER_LINE_PRINT:
+            if (
+                    recvLong(self, &(command.u.lp.from)) ||
+                    recvLong(self, &(command.u.lp.to))
+            ) command = (struct command_s){ .opcode=-1 };
+            break;
+        case COURIER_LOAD:
+            if (recvString(self, &(command.u.l.len), &(command.u.l.path)))
+                command = (struct command_s){ .opcode=-1 };
+            break;
+        case COURIER_SEARCH:
+            if (
+                    recvLong(self, &(command.u.f.mode)) ||
+                    recvString(self, &(command.u.f.len), &(command.u.f.data))
+            ) command = (struct command_s){ .opcode=-1 };
+            break;
+        case COURIER_REPLACE:
+            if (recvString(self, &(command.u.r.from_len), &(command.u.r.from)))
+                command = (struct command_s){ .opcode=-1 };
+            else if (recvString(self, &(command.u.r.to_len),
+                                &(command.u.r.to))) {
+                free(command.u.r.from);
+                command = (struct command_s){ .opcode=-1 };
+            }
+            break;
+        case COURIER_ADDRESSING:
+            if (recvLong(self, &(command.u.a.mode)) ||
+                    (command.u.a.mode < COURIER_ADDRESS_BYTES) ||
+                    (command.u.a.mode > COURIER_ADDRESS_CHARS))
+                command = (struct command_s){ .opcode=-1 };
+            break;
+        case COURIER_HASH:
+            if (
+                    recvPosition(self, &(command.u.h.from)) ||
+                    recvPosition(self, &(command.u.h.to))
+            ) command = (struct command_s){ .opcode=-1 };
+            break;
+        case COURIER_PRINT_RANGE:
+            if (
+                    recvPosition(self, &(command.u.pr.from)) ||
+                    recvPosition(self, &(command.u.pr.to))
+            ) command = (struct command_s){ .opcode=-1 };
+            break;
         case COURIER_PRINT:
+        case COURIER_CHECKPOINT:
+        case COURIER_UNDO:
+        case COURIER_REDO:
+        case COURIER_LINES:
+        case COURIER_DELTA_PRINT:
             break;
         default:
             fprintf(stderr, "Unrecoginzed opcode: %d\n", command.opcode);
@@ -123,55 +338,172 @@ struct command_s Courier_recvCommand(Courier *self) {
     return command;
 }
 
+int Courier_hasCommand(Courier *self) {
+    return hasBufferedCommand(self) || socket_pending(self->socket);
+}
+
+int Courier_flush(Courier *self) {
+    int len = self->output_len;
+    self->output_len = 0;
+    if ((self->version == 1) || (len == 0))
+        return socket_send(self->socket, self->output, len);
+
+    char header[VARINT_MAX];
+    struct iovec iov[2] = {
+        { .iov_base=header, .iov_len=encodeVarint(len, header) },
+        { .iov_base=self->output, .iov_len=len }
+    };
+    return socket_sendv(self->socket, iov, 2);
+}
+
 int Courier_sendCommand(Courier *self, struct command_s command) {
+    /* Positions are encoded against a copy of the last one sent, which
+     * only replaces it once the command is sent: the peer never sees a
+     * command that is rejected. */
+    struct message_s m = { .version=self->version };
+    int position = self->sent_position;
+    putLong(&m, command.opcode);
+
     switch (command.opcode) {
         case COURIER_INSERT:
-            if (
-                sendLong(self, command.opcode) ||
-                sendLong(self, command.u.i.pos) ||
-                sendString(self, command.u.i.len, command.u.i.data)
-            ) return -1;
+            putPosition(&m, &position, command.u.i.pos);
+            putString(&m, command.u.i.len, command.u.i.data);
             break;
         case COURIER_DELETE:
-            if (
-                sendLong(self, command.opcode) ||
-                sendLong(self, command.u.d.from) ||
-                sendLong(self, command.u.d.to)
-            ) return -1;
+            putPosition(&m, &position, command.u.d.from);
+            putPosition(&m, &position, command.u.d.to);
             break;
         case COURIER_SPACE:
-            if (
-                sendLong(self, command.opcode) ||
-                sendLong(self, command.u.s.pos)
-            ) return -1;
+            putPosition(&m, &position, command.u.s.pos);
             break;
         case COURIER_NEWLINE:
-            if (
-                sendLong(self, command.opcode) ||
-                sendLong(self, command.u.n.pos)
-            ) return -1;
+            putPosition(&m, &position, command.u.n.pos);
+            break;
+        case COURIER_LINE_INSERT:
+            putLong(&m, command.u.li.line);
+            putLong(&m, command.u.li.column);
+            putString(&m, command.u.li.len, command.u.li.data);
+            break;
+        case COURIER_LINE_DELETE:
+            putLong(&m, command.u.ld.from_line);
+            putLong(&m, command.u.ld.from_column);
+            putLong(&m, command.u.ld.to_line);
+            putLong(&m, command.u.ld.to_column);
+            break;
+        case COURIER_LINE_PRINT:
+            putLong(&m, command.u.lp.from);
+            putLong(&m, command.u.lp.to);
+            break;
+        case COURIER_LOAD:
+            putString(&m, command.u.l.len, command.u.l.path);
+            break;
+        case COURIER_SEARCH:
+            putLong(&m, command.u.f.mode);
+            putString(&m, command.u.f.len, command.u.f.data);
+            break;
+        case COURIER_REPLACE:
+            putString(&m, command.u.r.from_len, command.u.r.from);
+            putString(&m, command.u.r.to_len, command.u.r.to);
+            break;
+        case COURIER_ADDRESSING:
+            putLong(&m, command.u.a.mode);
+            break;
+        case COURIER_HASH:
+            putPosition(&m, &position, command.u.h.from);
+            putPosition(&m, &position, command.u.h.to);
+            break;
+        case COURIER_PRINT_RANGE:
+            putPosition(&m, &position, command.u.pr.from);
+            putPosition(&m, &position, command.u.pr.to);
             break;
         case COURIER_PRINT:
-            if (sendLong(self, command.opcode)) return -1;
+        case COURIER_CHECKPOINT:
+        case COURIER_UNDO:
+        case COURIER_REDO:
+        case COURIER_LINES:
+        case COURIER_DELTA_PRINT:
             break;
         default:
             fprintf(stderr, "Unrecoginzed opcode: %d\n", command.opcode);
-            command = (struct command_s){ .opcode=-1 };
+            return -1;
     }
+    if ((m.version != 1) && (m.len > COURIER_MAX_COMMAND_FRAME)) return -1;
+    if (sendMessage(self, &m)) return -1;
+
+    self->sent_position = position;
     return 0;
 }
 
 struct response_s Courier_recvResponse(Courier *self) {
     struct response_s r;
-    if (recvLongString(self, &(r.len), &(r.data)) == -1) {
+    if (Courier_flush(self) ||
+            (recvLongString(self, &(r.len), &(r.data)) == -1)) {
         r = (struct response_s){ .len=-1 };
     }
     return r;
 }
 
 int Courier_sendResponse(Courier *self, struct response_s r) {
-    if (sendLongString(self, r.len, r.data) == -1) return -1;
+    struct message_s m = { .version=self->version };
+    putLongString(&m, r.len, r.data);
+
+    if (sendMessage(self, &m)) return -1;
+    return Courier_flush(self);
+}
+
+int Courier_sendResponseFrom(Courier *self, int len,
+                             response_source_t source, void *state) {
+    struct iovec iov[RESPONSE_IOV_MAX];
+    char header[2 * VARINT_MAX];
+    int corked = 0;
+
+    if (self->version == 1) {
+        /* The length, and whatever else is buffered, goes out in the same
+         * writev as the first batch. */
+        int l = htonl(len);
+        if (bufferOut(self, &l, 4)) return -1;
+        iov[0] = (struct iovec){
+            .iov_base=self->output, .iov_len=self->output_len
+        };
+    } else {
+        /* The response is a frame of its own, and its header goes out with
+         * the first batch. */
+        if (Courier_flush(self)) return -1;
+
+        char prefix[VARINT_MAX];
+        int prefix_len = encodeVarint(len, prefix);
+        int header_len = encodeVarint(prefix_len + len, header);
+        memcpy(header + header_len, prefix, prefix_len);
+        iov[0] = (struct iovec){
+            .iov_base=header, .iov_len=header_len + prefix_len
+        };
+    }
+    int n = 1;
+
+    const char *data;
+    int data_len;
+    while (source(state, &data, &data_len)) {
+        iov[n++] = (struct iovec){
+            .iov_base=(void *) data, .iov_len=data_len
+        };
+        if (n == RESPONSE_IOV_MAX) {
+            /* More batches follow, so hold back the segment the end of
+             * this one would leave partly filled. */
+            if (!corked) corked = (socket_set_cork(self->socket, 1) == 0);
+            if (socket_sendv(self->socket, iov, n)) goto error;
+            n = 0;
+        }
+    }
+
+    if ((n > 0) && socket_sendv(self->socket, iov, n)) goto error;
+    self->output_len = 0;
+    if (corked) socket_set_cork(self->socket, 0);
     return 0;
+
+error:
+    self->output_len = 0;
+    if (corked) socket_set_cork(self->socket, 0);
+    return -1;
 }
 
 static void readPrint(struct command_s *in) {
@@ -197,7 +529,7 @@ static void readInsert(struct command_s *in) {
     if (!s) return;
 
     if (scanf("%d %256s", &(in->u.i.pos), s) == 2) {
-        in->u.i.len = (short int) strlen(s);
+        in->u.i.len = strlen(s);
         in->u.i.data = s;
         in->opcode = 1;
     } else {
@@ -213,45 +545,435 @@ static void readDelete(struct command_s *in) {
         in->opcode = -1;
 }
 
-static int sendLong(Courier *self, int l) {
-    l = htonl(l);
-    return socket_send(self->socket, &l, 4);
+static void readHistory(struct command_s *in, int opcode) {
+    in->opcode = opcode;
+}
+
+static void readLineInsert(struct command_s *in) {
+    char *s = malloc(INSERT_MAX_SIZE);
+    if (!s) return;
+
+    if (scanf("%d %d %256s", &(in->u.li.line), &(in->u.li.column), s) == 3) {
+        in->u.li.len = strlen(s);
+        in->u.li.data = s;
+        in->opcode = COURIER_LINE_INSERT;
+    } else {
+        free(s);
+        in->opcode = -1;
+    }
+}
+
+static void readLineDelete(struct command_s *in) {
+    if (scanf("%d %d %d %d", &(in->u.ld.from_line), &(in->u.ld.from_column),
+              &(in->u.ld.to_line), &(in->u.ld.to_column)) == 4)
+        in->opcode = COURIER_LINE_DELETE;
+    else
+        in->opcode = -1;
+}
+
+static void readLinePrint(struct command_s *in) {
+    if (scanf("%d %d", &(in->u.lp.from), &(in->u.lp.to)) == 2)
+        in->opcode = COURIER_LINE_PRINT;
+    else
+        in->opcode = -1;
+}
+
+static void readLines(struct command_s *in) {
+    in->opcode = COURIER_LINES;
+}
+
+static void readLoad(struct command_s *in) {
+    char *s = malloc(LOAD_PATH_SIZE);
+    if (!s) return;
+
+    if (scanf("%4095s", s) == 1) {
+        in->u.l.len = strlen(s);
+        in->u.l.path = s;
+        in->opcode = COURIER_LOAD;
+    } else {
+        free(s);
+        in->opcode = -1;
+    }
+}
+
+static void readSearch(struct command_s *in) {
+    const char *modes[] = { "first", "all", "count" };
+    char mode[8];
+    char *s = malloc(INSERT_MAX_SIZE);
+    if (!s) return;
+
+    in->opcode = -1;
+    if (scanf("%7s %256s", mode, s) == 2) {
+        for (int i = 0; i < 3; i++) {
+            if (strcmp(modes[i], mode)) continue;
+            in->u.f.mode = i;
+            in->u.f.len = strlen(s);
+            in->u.f.data = s;
+            in->opcode = COURIER_SEARCH;
+        }
+    }
+    if (in->opcode == -1) free(s);
+}
+
+static void readReplace(struct command_s *in) {
+    char *from = malloc(INSERT_MAX_SIZE);
+    char *to = malloc(INSERT_MAX_SIZE);
+
+    if (from && to && (scanf("%256s %256s", from, to) == 2)) {
+        in->u.r.from_len = strlen(from);
+        in->u.r.from = from;
+        in->u.r.to_len = strlen(to);
+        in->u.r.to = to;
+        in->opcode = COURIER_REPLACE;
+    } else {
+        free(from);
+        free(to);
+        in->opcode = -1;
+    }
+}
+
+static void readAddressing(struct command_s *in) {
+    char mode[8];
+
+    in->opcode = -1;
+    if (scanf("%7s", mode) != 1) return;
+
+    if (strcmp("bytes", mode) == 0) {
+        in->u.a.mode = COURIER_ADDRESS_BYTES;
+        in->opcode = COURIER_ADDRESSING;
+    } else if (strcmp("chars", mode) == 0) {
+        in->u.a.mode = COURIER_ADDRESS_CHARS;
+        in->opcode = COURIER_ADDRESSING;
+    }
+}
+
+static void readHash(struct command_s *in) {
+    if (scanf("%d %d", &(in->u.h.from), &(in->u.h.to)) == 2)
+        in->opcode = COURIER_HASH;
+    else
+        in->opcode = -1;
+}
+
+static void readPrintRange(struct command_s *in) {
+    if (scanf("%d %d", &(in->u.pr.from), &(in->u.pr.to)) == 2)
+        in->opcode = COURIER_PRINT_RANGE;
+    else
+        in->opcode = -1;
+}
+
+static void readDeltaPrint(struct command_s *in) {
+    in->opcode = COURIER_DELTA_PRINT;
+}
+
+/* Answers a HELLO, whose opcode has just been received, with the latest
+ * version both ends speak, and switches to it.
+ *
+ * On success, 0 is returned. On error, -1 is returned */
+static int negotiate(Courier *self) {
+    int version;
+    if (recvLong(self, &version)) return -1;
+    if (version > COURIER_VERSION) version = COURIER_VERSION;
+    if (version < 1) version = 1;
+
+    struct message_s m = { .version=self->version };
+    putLong(&m, version);
+    if (sendMessage(self, &m) || Courier_flush(self)) return -1;
+
+    self->version = version;
+    return 0;
+}
+
+/* Numbers are signed, and are zigzag encoded before going in a varint, so
+ * that small negative ones are short too. */
+static void putLong(struct message_s *m, int l) {
+    char *dest = m->head + m->head_len;
+    int len;
+    if (m->version == 1) {
+        l = htonl(l);
+        memcpy(dest, &l, 4);
+        len = 4;
+    } else {
+        unsigned int zigzag = ((unsigned int) l << 1) ^ (l < 0 ? ~0u : 0u);
+        len = encodeVarint(zigzag, dest);
+    }
+    m->head_len += len;
+    putPart(m, dest, len);
+}
+
+/* In version 2, pos goes as its difference from last, and becomes the new
+ * last, so that typing in one place sends a byte or two per position. The
+ * difference wraps around, as does adding it back. */
+static void putPosition(struct message_s *m, int *last, int pos) {
+    if (m->version == 1) {
+        putLong(m, pos);
+        return;
+    }
+
+    putLong(m, (int) ((unsigned int) pos - (unsigned int) *last));
+    *last = pos;
+}
+
+/* Version 1 sends the length of a string in 2 bytes, which limits how long
+ * it can be. In version 2, it must fit in the frame of a command. */
+static void putString(struct message_s *m, int len, const char *buf) {
+    char *dest = m->head + m->head_len;
+    int prefix_len;
+    if (len < 0) m->failed = 1;
+    if (m->version == 1) {
+        if (len > COURIER_MAX_STRING_V1) m->failed = 1;
+        unsigned short s = htons((unsigned short) len);
+        memcpy(dest, &s, 2);
+        prefix_len = 2;
+    } else {
+        if (len > COURIER_MAX_COMMAND_FRAME) m->failed = 1;
+        prefix_len = encodeVarint(len, dest);
+    }
+    m->head_len += prefix_len;
+    putPart(m, dest, prefix_len);
+    putPart(m, buf, len);
 }
 
-static int sendShort(Courier *self, short int s) {
-    s = htons(s);
-    return socket_send(self->socket, &s, 2);
+static void putLongString(struct message_s *m, int len, const char *buf) {
+    if (m->version == 1) {
+        putLong(m, len);
+    } else {
+        char *dest = m->head + m->head_len;
+        int prefix_len = encodeVarint(len, dest);
+        m->head_len += prefix_len;
+        putPart(m, dest, prefix_len);
+    }
+    putPart(m, buf, len);
 }
 
-static int sendString(Courier *self, short int len, char *buf) {
-    if (sendShort(self, len) == -1) return -1;
-    return socket_send(self->socket, buf, len);
+/* Adds len bytes of data to m, as a part of its own unless they follow the
+ * last part. */
+static void putPart(struct message_s *m, const void *data, int len) {
+    struct iovec *last = m->parts + m->n_parts - 1;
+    if (len == 0) return;
+
+    m->len += len;
+    if ((m->n_parts > 0) &&
+            ((const char *) last->iov_base + last->iov_len == data)) {
+        last->iov_len += len;
+        return;
+    }
+    m->parts[m->n_parts++] = (struct iovec){
+        .iov_base=(void *) data, .iov_len=len
+    };
 }
 
-static int sendLongString(Courier *self, int len, char *buf) {
-    if (sendLong(self, len) == -1) return -1;
-    return socket_send(self->socket, buf, len);
+/* Adds m to the output buffer. In version 2, the buffer is flushed first if
+ * m does not fit in it, so that m is not cut between two frames, and an m
+ * bigger than the whole buffer goes out right away, as a frame of its own.
+ *
+ * On success, 0 is returned. On error, -1 is returned */
+static int sendMessage(Courier *self, const struct message_s *m) {
+    if (m->failed) return -1;
+
+    if (self->version == 1) {
+        for (int i = 0; i < m->n_parts; i++)
+            if (bufferOut(self, m->parts[i].iov_base, m->parts[i].iov_len))
+                return -1;
+        return 0;
+    }
+
+    if ((self->output_len + m->len > OUTPUT_SIZE) && Courier_flush(self))
+        return -1;
+
+    if (m->len > OUTPUT_SIZE) {
+        char header[VARINT_MAX];
+        struct iovec iov[MESSAGE_PARTS_MAX + 1];
+        iov[0] = (struct iovec){
+            .iov_base=header, .iov_len=encodeVarint(m->len, header)
+        };
+        memcpy(iov + 1, m->parts, m->n_parts * sizeof(struct iovec));
+        return socket_sendv(self->socket, iov, m->n_parts + 1);
+    }
+
+    for (int i = 0; i < m->n_parts; i++) {
+        memcpy(self->output + self->output_len, m->parts[i].iov_base,
+               m->parts[i].iov_len);
+        self->output_len += m->parts[i].iov_len;
+    }
+    return 0;
+}
+
+/* Appends len bytes of data to the output buffer, flushing it first if they
+ * do not fit. Data longer than the whole buffer is then sent right away.
+ * Only version 1 cuts messages like this.
+ *
+ * On success, 0 is returned. On error, -1 is returned */
+static int bufferOut(Courier *self, const void *data, int len) {
+    if (self->output_len + len > OUTPUT_SIZE) {
+        if (Courier_flush(self)) return -1;
+        if (len > OUTPUT_SIZE) return socket_send(self->socket, data, len);
+    }
+
+    memcpy(self->output + self->output_len, data, len);
+    self->output_len += len;
+    return 0;
+}
+
+/* Writes value into dest as a LEB128 varint: 7 bits per byte, least
+ * significant first, with the high bit set on every byte but the last.
+ *
+ * Returns the number of bytes written, VARINT_MAX at most. */
+static int encodeVarint(unsigned int value, char *dest) {
+    int len = 0;
+    while (value >= 0x80) {
+        dest[len++] = (char) ((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    dest[len++] = (char) value;
+    return len;
+}
+
+/* Tells whether the input buffer holds a whole command. A command with an
+ * unknown opcode counts as whole, since decoding it fails right away.
+ *
+ * In version 2, frames hold whole commands, so a command is whole if the
+ * rest of the frame being read is buffered, or the whole next frame is. */
+static int hasBufferedCommand(const Courier *self) {
+    const unsigned char *p =
+        (const unsigned char *) self->input + self->input_begin;
+    const unsigned char *end =
+        (const unsigned char *) self->input + self->input_end;
+
+    if (self->version != 1) {
+        if (self->frame_left > 0) return end - p >= self->frame_left;
+
+        unsigned int len = 0;
+        for (int shift = 0; (p < end) && (shift < 7 * VARINT_MAX);
+             shift += 7) {
+            len |= (unsigned int) (*p & 0x7f) << shift;
+            if (!(*p++ & 0x80))
+                return (len > 0) && ((unsigned int) (end - p) >= len);
+        }
+        return 0;
+    }
+
+    int opcode;
+    if (end - p < 4) return 0;
+    memcpy(&opcode, p, 4);
+    opcode = ntohl(opcode);
+    p += 4;
+    if ((opcode < COURIER_INSERT) || (opcode > COURIER_DELTA_PRINT))
+        return 1;
+
+    p += 4 * LAYOUTS[opcode].longs;
+    for (int i = 0; i < LAYOUTS[opcode].strings; i++) {
+        unsigned short len;
+        if (end - p < 2) return 0;
+        memcpy(&len, p, 2);
+        p += 2 + ntohs(len);
+    }
+    return p <= end;
+}
+
+/* Fills dest with the next len bytes received. They are taken from the
+ * input buffer, which is refilled with a single recv whenever it runs out.
+ * What would not fit in the buffer anyway is received straight into dest.
+ *
+ * On success, 0 is returned. On error, -1 is returned */
+static int recvBytes(Courier *self, void *dest, int len) {
+    char *out = dest;
+    int buffered = self->input_end - self->input_begin;
+    while (len > buffered) {
+        memcpy(out, self->input + self->input_begin, buffered);
+        out += buffered;
+        len -= buffered;
+        self->input_begin = self->input_end = 0;
+        if (len >= INPUT_SIZE) return socket_receive(self->socket, out, len);
+
+        int n = socket_receive_some(self->socket, self->input, INPUT_SIZE);
+        if (n < 1) return -1;
+        self->input_end = buffered = n;
+    }
+
+    memcpy(out, self->input + self->input_begin, len);
+    self->input_begin += len;
+    return 0;
+}
+
+/* Same as recvBytes, for the bytes of a message. In version 2, the header
+ * of the next frame is read first when the last one is over, and a message
+ * running past the end of its frame is an error. */
+static int recvPayload(Courier *self, void *dest, int len) {
+    if ((self->version == 1) || (len == 0)) return recvBytes(self, dest, len);
+
+    while (self->frame_left == 0) {
+        unsigned int frame_len;
+        if (recvVarint(self, &frame_len, 0) || (frame_len > INT_MAX))
+            return -1;
+        self->frame_left = frame_len;
+    }
+
+    if (len > self->frame_left) return -1;
+    self->frame_left -= len;
+    return recvBytes(self, dest, len);
+}
+
+/* Reads a LEB128 varint, from the bytes of a message if framed is set, or
+ * else from the bytes between them.
+ *
+ * On success, 0 is returned. On error, -1 is returned */
+static int recvVarint(Courier *self, unsigned int *value, int framed) {
+    *value = 0;
+    for (int shift = 0; shift < 7 * VARINT_MAX; shift += 7) {
+        unsigned char byte;
+        if (framed ? recvPayload(self, &byte, 1) : recvBytes(self, &byte, 1))
+            return -1;
+
+        *value |= (unsigned int) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return 0;
+    }
+    return -1;
 }
 
 static int recvLong(Courier *self, int *l) {
-    if (socket_receive(self->socket, l, 4)) return -1;
-    *l = ntohl(*l);
+    if (self->version == 1) {
+        if (recvBytes(self, l, 4)) return -1;
+        *l = ntohl(*l);
+        return 0;
+    }
+
+    unsigned int zigzag;
+    if (recvVarint(self, &zigzag, 1)) return -1;
+    *l = (int) ((zigzag >> 1) ^ (0u - (zigzag & 1)));
     return 0;
 }
 
-static int recvShort(Courier *self, short int *s) {
-    if (socket_receive(self->socket, s, 2)) return -1;
-    *s = ntohs(*s);
+static int recvPosition(Courier *self, int *pos) {
+    if (self->version == 1) return recvLong(self, pos);
+
+    int delta;
+    if (recvLong(self, &delta)) return -1;
+    *pos = (int) ((unsigned int) self->received_position +
+                  (unsigned int) delta);
+    self->received_position = *pos;
     return 0;
 }
 
-static int recvString(Courier *self, short int *len, char **buf) {
-    if (recvShort(self, len) == -1) return -1;
+/* In version 2, a length longer than COURIER_MAX_COMMAND_FRAME, or than
+ * what is left of the frame, is rejected before anything is allocated for
+ * it. */
+static int recvString(Courier *self, int *len, char **buf) {
+    if (self->version == 1) {
+        unsigned short s;
+        if (recvBytes(self, &s, 2)) return -1;
+        *len = ntohs(s);
+    } else {
+        unsigned int l;
+        if (recvVarint(self, &l, 1) || (l > COURIER_MAX_COMMAND_FRAME) ||
+                (l > (unsigned int) self->frame_left))
+            return -1;
+        *len = l;
+    }
 
     *buf = malloc(*len + 1);
-    if (!buf) return -1;
+    if (!*buf) return -1;
 
-    if (socket_receive(self->socket, *buf, *len)) {
+    if (recvPayload(self, *buf, *len)) {
         free(*buf);
         return -1;
     }
@@ -260,13 +982,24 @@ static int recvString(Courier *self, short int *len, char **buf) {
     return 0;
 }
 
+/* Same as recvString, for responses, which have no length limit but that
+ * of their frame in version 2. */
 static int recvLongString(Courier *self, int *len, char **buf) {
-    if (recvLong(self, len) == -1) return -1;
+    if (self->version == 1) {
+        if (recvLong(self, len) == -1) return -1;
+    } else {
+        unsigned int l;
+        if (recvVarint(self, &l, 1) || (l > INT_MAX - 1) ||
+                (l > (unsigned int) self->frame_left))
+            return -1;
+        *len = l;
+    }
+    if (*len < 0) return -1;
 
     *buf = malloc(*len + 1);
-    if (!buf) return -1;
+    if (!*buf) return -1;
 
-    if (socket_receive(self->socket, *buf, *len)) {
+    if (recvPayload(self, *buf, *len)) {
         free(*buf);
         return -1;
     }
@@ -6,13 +6,51 @@
 /* Please be adviced: command_s and response_s also have destructor functions
  * associated. */
 
-struct insert_command_s { int pos; short int len; char *data; };
+/* The latest version of the wire format. Version 1 sends every number as 4
+ * bytes, big endian; version 2 sends them as LEB128 varints, in frames. */
+#define COURIER_VERSION 2
+
+/* The longest string a command can carry in version 1, which sends its
+ * length in 2 bytes. */
+#define COURIER_MAX_STRING_V1 65535
+
+/* The longest command version 2 sends, whole in a frame of its own or along
+ * with others. A string longer than this is never received, nor one longer
+ * than what is left of its frame, so this bounds what a peer can make the
+ * other allocate for a command. Responses are not bounded by it. */
+#define COURIER_MAX_COMMAND_FRAME (1 << 24)
+
+struct insert_command_s { int pos; int len; char *data; };
 struct delete_command_s { int from; int to; };
 struct space_command_s { int pos; };
 struct newline_command_s { int pos; };
+struct line_insert_command_s { int line; int column; int len; char *data; };
+struct line_delete_command_s { int from_line; int from_column;
+                               int to_line; int to_column; };
+struct line_print_command_s { int from; int to; };
+struct load_command_s { int len; char *path; };
+struct search_command_s { int mode; int len; char *data; };
+struct addressing_command_s { int mode; };
+struct replace_command_s { int from_len; char *from; int to_len; char *to; };
+struct hash_command_s { int from; int to; };
+struct print_range_command_s { int from; int to; };
 
 enum opcodes {COURIER_INSERT=1, COURIER_DELETE, COURIER_SPACE,
-                COURIER_NEWLINE, COURIER_PRINT};
+                COURIER_NEWLINE, COURIER_PRINT, COURIER_CHECKPOINT,
+                COURIER_UNDO, COURIER_REDO, COURIER_LINE_INSERT,
+                COURIER_LINE_DELETE, COURIER_LINE_PRINT, COURIER_LINES,
+                COURIER_LOAD, COURIER_SEARCH, COURIER_REPLACE,
+                COURIER_ADDRESSING, COURIER_HASH, COURIER_PRINT_RANGE,
+                COURIER_HELLO, COURIER_DELTA_PRINT};
+
+/* What a search responds with: the first match, every match, or how many
+ * there are. Matches do not overlap. */
+enum search_modes {COURIER_SEARCH_FIRST, COURIER_SEARCH_ALL,
+                   COURIER_SEARCH_COUNT};
+
+/* What positions sent by the client, and sent back to it, count: bytes, or
+ * UTF-8 characters. A session starts addressing bytes. */
+enum addressing_modes {COURIER_ADDRESS_BYTES, COURIER_ADDRESS_CHARS};
 
 struct command_s {
     int opcode;
@@ -21,11 +59,26 @@ struct command_s {
         struct delete_command_s d;
         struct space_command_s s;
         struct newline_command_s n;
+        struct line_insert_command_s li;
+        struct line_delete_command_s ld;
+        struct line_print_command_s lp;
+        struct load_command_s l;
+        struct search_command_s f;
+        struct replace_command_s r;
+        struct addressing_command_s a;
+        struct hash_command_s h;
+        struct print_range_command_s pr;
     } u;
 };
 
 struct response_s { int len; char *data; };
 
+/* Produces the contents of a response piece by piece.
+ *
+ * Returns 1 and sets data and len to the next piece, or returns 0 when there
+ * are no more pieces. */
+typedef int (*response_source_t)(void *state, const char **data, int *len);
+
 typedef struct Courier Courier;
 
 /******************************************************************************/
@@ -33,7 +86,7 @@ typedef struct Courier Courier;
 
 Courier *Courier_new(socket_t *socket);
 
-/* Will not close the socket. */
+/* Sends whatever is still buffered. Will not close the socket. */
 void Courier_destroy(Courier *self);
 
 void Courier_destroyCommand(struct command_s self);
@@ -43,31 +96,74 @@ void Courier_destroyResponse(struct response_s self);
 /******************************************************************************/
 /* Operations. */
 
+/* Agrees with the server on the latest version of the wire format both
+ * speak, and switches to it. Until then, a courier speaks version 1, which
+ * is all that clients that never call this speak.
+ *
+ * It must be called before sending any command. The server answers it
+ * within Courier_recvCommand, which never returns it as a command.
+ *
+ * On success, 0 is returned. On error, -1 is returned */
+int Courier_hello(Courier *self);
+
+/* Returns the version of the wire format in use, 1 until Courier_hello has
+ * agreed on a later one. */
+int Courier_version(const Courier *self);
+
 /* Reads a command from stdin.
  *
  * On error, opcode will be -1. If stdin has reached EOF, and no opcode has
  * been read yet, opcode will be 0. */
 struct command_s Courier_readCommand(Courier *self);
 
-/* Reads a command from the network socket.
+/* Reads a command from the network socket, after sending whatever is still
+ * buffered.
  *
  * On error, opcode will be -1. If socket has shut down, and no opcode has
  * been read yet, opcode will be 0. */
 struct command_s Courier_recvCommand(Courier *self);
 
+/* Returns 1 if another command is already received whole, or has started
+ * arriving on the network socket, so receiving it does not wait on the peer.
+ * Otherwise, 0 is returned. */
+int Courier_hasCommand(Courier *self);
+
 /* Sends a command through the network socket.
+ *
+ * The command is only buffered, and goes out along with the ones after it
+ * when the buffer fills up, or is flushed: before waiting for a response or
+ * a command, and when the courier is destroyed.
  *
  * On success, 0 is returned. On error, -1 is returned */
 int Courier_sendCommand(Courier *self, struct command_s command);
 
-/* Reads a response from the network socket.
+/* Sends whatever is buffered through the network socket, with a single
+ * send when possible.
+ *
+ * On success, 0 is returned. On error, -1 is returned, and what was
+ * buffered is dropped. */
+int Courier_flush(Courier *self);
+
+/* Reads a response from the network socket, after sending whatever is still
+ * buffered.
  *
  * On error, len will be -1. */
 struct response_s Courier_recvResponse(Courier *self);
 
-/* Sends a response through the network socket.
+/* Sends a response through the network socket, along with whatever is
+ * still buffered.
  *
  * On success, 0 is returned. On error, -1 is returned */
 int Courier_sendResponse(Courier *self, struct response_s r);
 
+/* Sends a response of len bytes, whose contents are pulled from source.
+ *
+ * Pieces are gathered in batches and sent with a single writev each, so the
+ * response is never copied into a contiguous buffer. The socket is corked
+ * while batches follow each other, so they are not cut in small segments.
+ *
+ * On success, 0 is returned. On error, -1 is returned */
+int Courier_sendResponseFrom(Courier *self, int len,
+                             response_source_t source, void *state);
+
 #endif
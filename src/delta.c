@@ -0,0 +1,301 @@
+/* Tracks what has changed in a document since a reader last received it. */
+
+#include "delta.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* More changes than this are not worth tracking: each edit shifts the ones
+ * after it, and the script would hardly be smaller than the text. */
+#define DELTA_MAX_CHANGES 4096
+#define DELTA_FIRST_CAPACITY 16
+#define DELTA_VARINT_MAX 5
+
+/* The bytes [pos, pos + new_len) of the document replace old_len bytes of
+ * the text the reader holds. Changes are kept sorted and apart from each
+ * other, so the text between them is what the reader already holds. */
+typedef struct {
+    int pos;
+    int old_len;
+    int new_len;
+} DeltaChange;
+
+/* size is that of the document, as the next edit finds it. Once stale, the
+ * changes are no longer tracked. */
+struct Delta {
+    int size;
+    int stale;
+    DeltaChange *changes;
+    int n_changes;
+    int capacity;
+};
+
+static int firstEndingAt(const Delta *self, int pos);
+static int makeRoom(Delta *self, int i);
+static int varintSize(unsigned int value);
+static int putVarint(unsigned int value, char *out);
+static int getVarint(const char **p, const char *end, unsigned int *value);
+static char *putRun(char *out, char tag, int len);
+static void copyRange(const Rope *rope, int begin, int len, char *out);
+static int runScript(const char *text, int len, const char *script,
+                     int script_len, char *out);
+
+Delta *Delta_new(int size) {
+    Delta *self = malloc(sizeof(Delta));
+    if (!self) return NULL;
+
+    *self = (Delta) {
+        .size = size, .stale = 0,
+        .changes = NULL, .n_changes = 0, .capacity = 0
+    };
+    return self;
+}
+
+void Delta_destroy(Delta *self) {
+    if (!self) return;
+    free(self->changes);
+    free(self);
+}
+
+int Delta_edit(Delta *self, int begin, int end, int len) {
+    if (self->stale) return 0;
+
+    if (begin < 0) begin += self->size + 1;
+    if (end < 0) end += self->size + 1;
+    if ((begin < 0) || (begin > end) || (end > self->size)) return -1;
+    if ((begin == end) && (len == 0)) return 0;
+
+    /* The changes from i to j - 1 touch the range, and are merged with it
+     * into a single one, spanning [lo, hi) before the edit. */
+    DeltaChange *changes = self->changes;
+    int i = firstEndingAt(self, begin);
+    int j = i;
+    int lo = begin, hi = end, old_len = 0;
+    for (; (j < self->n_changes) && (changes[j].pos <= end); j++) {
+        if (changes[j].pos < lo) lo = changes[j].pos;
+        if (changes[j].pos + changes[j].new_len > hi)
+            hi = changes[j].pos + changes[j].new_len;
+        old_len += changes[j].old_len - changes[j].new_len;
+    }
+
+    if ((i == j) && makeRoom(self, i)) return 0;
+    changes = self->changes;
+    if (j - i > 1) {
+        memmove(changes + i + 1, changes + j,
+                (self->n_changes - j) * sizeof(DeltaChange));
+        self->n_changes -= j - i - 1;
+    }
+
+    int shift = len - (end - begin);
+    changes[i] = (DeltaChange) {
+        .pos = lo, .old_len = old_len + hi - lo, .new_len = hi - lo + shift
+    };
+    for (int k = i + 1; k < self->n_changes; k++) changes[k].pos += shift;
+    self->size += shift;
+
+    /* Text inserted and then deleted again leaves nothing to send. */
+    if ((changes[i].old_len == 0) && (changes[i].new_len == 0)) {
+        memmove(changes + i, changes + i + 1,
+                (self->n_changes - i - 1) * sizeof(DeltaChange));
+        self->n_changes--;
+    }
+    return 0;
+}
+
+void Delta_invalidate(Delta *self) {
+    self->stale = 1;
+}
+
+void Delta_reset(Delta *self, int size) {
+    self->size = size;
+    self->stale = 0;
+    self->n_changes = 0;
+}
+
+int Delta_script(const Delta *self, const Rope *rope, char **script) {
+    if (self->stale) return -1;
+
+    /* Sized first, so that nothing is built when the whole text is smaller.
+     * kept is where the text kept after the last change starts. */
+    int len = 0, kept = 0;
+    for (int i = 0; i < self->n_changes; i++) {
+        const DeltaChange *change = self->changes + i;
+        if (change->pos > kept) len += 1 + varintSize(change->pos - kept);
+        if (change->old_len > 0) len += 1 + varintSize(change->old_len);
+        if (change->new_len > 0)
+            len += 1 + varintSize(change->new_len) + change->new_len;
+        if (len > Rope_size(rope)) return -1;
+        kept = change->pos + change->new_len;
+    }
+
+    char *out = malloc(len > 0 ? len : 1);
+    if (!out) return -1;
+
+    *script = out;
+    kept = 0;
+    for (int i = 0; i < self->n_changes; i++) {
+        const DeltaChange *change = self->changes + i;
+        if (change->pos > kept) out = putRun(out, '=', change->pos - kept);
+        if (change->old_len > 0) out = putRun(out, '-', change->old_len);
+        if (change->new_len > 0) {
+            out = putRun(out, '+', change->new_len);
+            copyRange(rope, change->pos, change->new_len, out);
+            out += change->new_len;
+        }
+        kept = change->pos + change->new_len;
+    }
+    return len;
+}
+
+char *Delta_apply(const char *text, int len, const char *script,
+                  int script_len, int *new_len) {
+    if ((script_len > 0) && (script[0] == '*')) {
+        text = script + 1;
+        len = script_len - 1;
+        script_len = 0;
+    }
+
+    int size = runScript(text, len, script, script_len, NULL);
+    if (size < 0) return NULL;
+
+    char *out = malloc(size + 1);
+    if (!out) return NULL;
+
+    runScript(text, len, script, script_len, out);
+    out[size] = '\0';
+    *new_len = size;
+    return out;
+}
+
+/* Returns the index of the first change that ends at pos or after it. */
+static int firstEndingAt(const Delta *self, int pos) {
+    int lo = 0, hi = self->n_changes;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        const DeltaChange *change = self->changes + mid;
+        if (change->pos + change->new_len < pos) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* Opens a slot for a new change at index i, growing the array if needed.
+ *
+ * On success, zero is returned. On error, -1 is returned and self gives up
+ * tracking changes. */
+static int makeRoom(Delta *self, int i) {
+    if (self->n_changes == self->capacity) {
+        int capacity = self->capacity ? 2 * self->capacity :
+            DELTA_FIRST_CAPACITY;
+        DeltaChange *grown = NULL;
+        if (capacity <= DELTA_MAX_CHANGES)
+            grown = realloc(self->changes, capacity * sizeof(DeltaChange));
+        if (!grown) {
+            self->stale = 1;
+            return -1;
+        }
+        self->changes = grown;
+        self->capacity = capacity;
+    }
+
+    memmove(self->changes + i + 1, self->changes + i,
+            (self->n_changes - i) * sizeof(DeltaChange));
+    self->n_changes++;
+    return 0;
+}
+
+static int varintSize(unsigned int value) {
+    int n = 1;
+    while (value >>= 7) n++;
+    return n;
+}
+
+/* Writes value as an unsigned LEB128 varint: seven bits per byte, lowest
+ * first, with the high bit set on every byte but the last.
+ *
+ * Returns the number of bytes written. */
+static int putVarint(unsigned int value, char *out) {
+    int n = 0;
+    while (value >= 0x80) {
+        out[n++] = (char) (value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (char) value;
+    return n;
+}
+
+/* Reads a varint at *p, not going past end, and moves *p after it.
+ *
+ * On success, zero is returned. If there is no whole varint, -1 is
+ * returned. */
+static int getVarint(const char **p, const char *end, unsigned int *value) {
+    *value = 0;
+    for (int shift = 0; (*p < end) && (shift < 7 * DELTA_VARINT_MAX);
+         shift += 7) {
+        unsigned char byte = *(*p)++;
+        *value |= (unsigned int) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return 0;
+    }
+    return -1;
+}
+
+static char *putRun(char *out, char tag, int len) {
+    *out++ = tag;
+    return out + putVarint(len, out);
+}
+
+/* Copies the len bytes of rope starting at begin, which must be valid, into
+ * out. */
+static void copyRange(const Rope *rope, int begin, int len, char *out) {
+    RopeIter it;
+    int skip = Rope_iterSeek(rope, &it, begin);
+    const char *text;
+    int n;
+    while ((len > 0) && Rope_iterNext(&it, &text, &n)) {
+        text += skip;
+        n -= skip;
+        skip = 0;
+        if (n > len) n = len;
+        memcpy(out, text, n);
+        out += n;
+        len -= n;
+    }
+}
+
+/* Applies script to the len bytes of text, writing the result to out, or
+ * only measuring it if out is NULL.
+ *
+ * Returns the length of the result, or -1 if the script does not fit text. */
+static int runScript(const char *text, int len, const char *script,
+                     int script_len, char *out) {
+    const char *p = script, *end = script + script_len;
+    int at = 0, size = 0;
+    while (p < end) {
+        char tag = *p++;
+        unsigned int n;
+        if (getVarint(&p, end, &n)) return -1;
+
+        switch (tag) {
+            case '=':
+                if (n > (unsigned int) (len - at)) return -1;
+                if (out) memcpy(out + size, text + at, n);
+                at += n;
+                size += n;
+                break;
+            case '-':
+                if (n > (unsigned int) (len - at)) return -1;
+                at += n;
+                break;
+            case '+':
+                if (n > (unsigned int) (end - p)) return -1;
+                if (out) memcpy(out + size, p, n);
+                p += n;
+                size += n;
+                break;
+            default:
+                return -1;
+        }
+    }
+
+    if (out) memcpy(out + size, text + at, len - at);
+    return size + len - at;
+}
@@ -0,0 +1,64 @@
+/* Tracks what has changed in a document since a reader last received it, so
+ * that only that is sent again, as an edit script.
+ *
+ * A script is a sequence of runs, each a tag byte followed by a length, as
+ * an unsigned LEB128 varint: '=' keeps that many bytes of the old text, '-'
+ * drops them, and '+' inserts the bytes that follow the length. Whatever is
+ * left of the old text after the last run is kept as well. A script may
+ * instead be a '*' followed by the whole new text, which is how a document
+ * is sent when its changes were not tracked. */
+
+#ifndef DELTA_H
+#define DELTA_H
+
+#include "rope.h"
+
+typedef struct Delta Delta;
+
+/* Creates a delta over a document of size bytes, which the reader already
+ * holds.
+ *
+ * On success, a pointer to the new delta is returned. On error, NULL is
+ * returned. */
+Delta *Delta_new(int size);
+
+void Delta_destroy(Delta *self);
+
+/* Records that the range [begin, end) of the document was replaced by len
+ * bytes. Positions follow the rules of Rope_applyBatch: negative ones count
+ * from the end, and edits out of range are not made, so recording every
+ * edit of a batch keeps self in step with the rope.
+ *
+ * Edits that touch are merged, so typing in one place grows a single change.
+ * When there are too many changes to track, or no memory to track them, self
+ * gives up until the next Delta_reset, as with Delta_invalidate, and edits
+ * are no longer checked.
+ *
+ * On success, zero is returned. If the range is not valid, -1 is returned. */
+int Delta_edit(Delta *self, int begin, int end, int len);
+
+/* Records that the document changed in a way that was not tracked, such as
+ * being replaced by another one. */
+void Delta_invalidate(Delta *self);
+
+/* Forgets every change: the reader now holds the document, of size bytes. */
+void Delta_reset(Delta *self, int size);
+
+/* Sets script to the edit script that turns the text the reader holds into
+ * the text of rope, which must be the document tracked by self. The script
+ * is obtained with malloc, and can be freed with free.
+ *
+ * Returns the length of the script. If self lost track of the changes, or
+ * the script would not be smaller than the whole text, or there is no memory
+ * for it, -1 is returned and the whole text should be sent instead. */
+int Delta_script(const Delta *self, const Rope *rope, char **script);
+
+/* Applies script, either form, to the len bytes of text.
+ *
+ * On success, a new null-terminated string obtained with malloc is returned,
+ * and new_len is set to its length. If the script does not fit text, or
+ * there is no memory, NULL is returned. */
+char *Delta_apply(const char *text, int len, const char *script,
+                  int script_len, int *new_len);
+
+#endif
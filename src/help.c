@@ -3,7 +3,7 @@
 #include <stdio.h>
 
 void printHelp() {
-    printf("./tp server [<port>]\n"
+    printf("./tp server [<port> [<root>]]\n"
            "./tp client <host> <port> [<inputfile>]\n");
 }
 
@@ -0,0 +1,414 @@
+/* Piece table with the pieces kept in a height balanced (AVL) tree.
+ *
+ * Unlike the rope, every node holds a piece, not only the leaves. Cutting
+ * the document at a position splits at most one piece in two, and both
+ * halves keep pointing at the same text, so no edit ever copies text that
+ * was already stored. */
+
+#include "piecetable.h"
+#include "pool.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Inserted text is appended to blocks of at least this many bytes. Blocks are
+ * never reallocated, so pieces can point straight into them. */
+#define PIECE_BLOCK_SIZE 65536
+
+typedef struct Block {
+    struct Block *next;
+    int used;
+    int capacity;
+    char text[];
+} Block;
+
+/* text and len are the span of the piece itself. size is the length of the
+ * whole subtree. Pieces are never empty; the empty table has no root. */
+typedef struct Piece {
+    struct Piece *lchild, *rchild;
+    const char *text;
+    int len;
+    int size;
+    int height;
+} Piece;
+
+/* blocks starts with the newest block. last is the piece the previous insert
+ * created or grew, and last_end the position right after it; an insert at
+ * last_end grows that piece while its text ends where the newest block does.
+ * Any other edit forgets it. */
+struct PieceTable {
+    Piece *root;
+    Pool *pieces;
+    Block *blocks;
+    Piece *last;
+    int last_end;
+};
+
+static const char *appendText(PieceTable *self, const char *text, int len);
+static Piece *newPiece(PieceTable *self, const char *text, int len);
+static void deleteTree(PieceTable *self, Piece *node);
+static int growLast(PieceTable *self, int pos, const char *text, int len);
+static void splitRecursive(PieceTable *self, Piece *node, int p,
+                           Piece **left, Piece **right);
+static Piece *join3(Piece *left, Piece *middle, Piece *right);
+static Piece *join(Piece *left, Piece *right);
+static Piece *removeFirst(Piece *node, Piece **first);
+static Piece *rebalance(Piece *self);
+static Piece *rotateLeft(Piece *self);
+static Piece *rotateRight(Piece *self);
+static void updatePiece(Piece *self);
+static int getHeight(const Piece *self);
+static int getSize(const Piece *self);
+static void pushLeftSpine(PieceTableIter *it, const Piece *self);
+
+PieceTable *PieceTable_new() {
+    PieceTable *self = malloc(sizeof(PieceTable));
+    if (!self) return NULL;
+
+    *self = (PieceTable) {
+        .root = NULL, .pieces = Pool_new(sizeof(Piece)), .blocks = NULL,
+        .last = NULL, .last_end = -1
+    };
+    if (!self->pieces) {
+        free(self);
+        return NULL;
+    }
+    return self;
+}
+
+PieceTable *PieceTable_buildFrom(const char *buf, int len) {
+    if (len < 0) return NULL;
+
+    PieceTable *self = PieceTable_new();
+    if (!self || (len == 0)) return self;
+
+    const char *text = appendText(self, buf, len);
+    self->root = text ? newPiece(self, text, len) : NULL;
+    if (!self->root) {
+        PieceTable_destroy(self);
+        return NULL;
+    }
+    return self;
+}
+
+void PieceTable_destroy(PieceTable *self) {
+    if (!self) return;
+
+    /* Every piece goes away with the pool, so the tree is not walked. */
+    Pool_destroy(self->pieces);
+
+    Block *block = self->blocks;
+    while (block) {
+        Block *next = block->next;
+        free(block);
+        block = next;
+    }
+    free(self);
+}
+
+PieceTable *PieceTable_insert(PieceTable *self, int pos, const char *text) {
+    if (pos < 0) pos += PieceTable_size(self) + 1;
+    if ((pos < 0) || (pos > PieceTable_size(self))) return NULL;
+
+    int len = strlen(text);
+    if (len == 0) return self;
+
+    if (growLast(self, pos, text, len) == 0) return self;
+
+    const char *stored = appendText(self, text, len);
+    Piece *piece = stored ? newPiece(self, stored, len) : NULL;
+    if (!piece) return NULL;
+
+    Piece *left, *right;
+    splitRecursive(self, self->root, pos, &left, &right);
+    self->root = join3(left, piece, right);
+
+    self->last = piece;
+    self->last_end = pos + len;
+    return self;
+}
+
+PieceTable *PieceTable_delete(PieceTable *self, int begin, int end) {
+    if (begin < 0) begin += PieceTable_size(self) + 1;
+    if (end < 0) end += PieceTable_size(self) + 1;
+
+    if ((begin < 0) || (end < 0) || (begin > end)) return NULL;
+    if (end > PieceTable_size(self)) return NULL;
+    if (begin == end) return self;
+
+    Piece *first, *middle, *last;
+    splitRecursive(self, self->root, end, &first, &last);
+    splitRecursive(self, first, begin, &first, &middle);
+
+    deleteTree(self, middle);
+    self->root = join(first, last);
+
+    self->last = NULL;
+    return self;
+}
+
+int PieceTable_size(const PieceTable *self) {
+    return getSize(self->root);
+}
+
+char *PieceTable_toString(const PieceTable *self) {
+    char *s = malloc(PieceTable_size(self) + 1);
+    if (!s) return NULL;
+
+    PieceTableIter it;
+    const char *text;
+    int len;
+    char *dest = s;
+
+    PieceTable_iterBegin(self, &it);
+    while (PieceTable_iterNext(&it, &text, &len)) {
+        memcpy(dest, text, len);
+        dest += len;
+    }
+    *dest = '\0';
+    return s;
+}
+
+void PieceTable_iterBegin(const PieceTable *self, PieceTableIter *it) {
+    it->top = 0;
+    pushLeftSpine(it, self->root);
+}
+
+int PieceTable_iterNext(PieceTableIter *it, const char **text, int *len) {
+    if (it->top == 0) return 0;
+
+    const Piece *piece = it->stack[--it->top];
+    *text = piece->text;
+    *len = piece->len;
+
+    pushLeftSpine(it, piece->rchild);
+    return 1;
+}
+
+/* Copies text at the end of the newest block, starting a new one if it has
+ * no room left.
+ *
+ * On success, a pointer to the stored copy is returned. On error, NULL is
+ * returned. */
+static const char *appendText(PieceTable *self, const char *text, int len) {
+    Block *block = self->blocks;
+    if (!block || (block->used + len > block->capacity)) {
+        int capacity = (len > PIECE_BLOCK_SIZE) ? len : PIECE_BLOCK_SIZE;
+        block = malloc(sizeof(Block) + capacity);
+        if (!block) return NULL;
+
+        *block = (Block) {
+            .next = self->blocks, .used = 0, .capacity = capacity
+        };
+        self->blocks = block;
+    }
+
+    char *dest = block->text + block->used;
+    memcpy(dest, text, len);
+    block->used += len;
+    return dest;
+}
+
+static Piece *newPiece(PieceTable *self, const char *text, int len) {
+    Piece *piece = Pool_alloc(self->pieces);
+    if (!piece) return NULL;
+
+    *piece = (Piece) {
+        .lchild = NULL, .rchild = NULL, .text = text, .len = len,
+        .size = len, .height = 0
+    };
+    return piece;
+}
+
+/* Gives every piece under node back to the pool. Their text stays where it
+ * is, as blocks are only released with the table.
+ *
+ * Left children are rotated up until the piece on top has none, so no stack
+ * is needed. */
+static void deleteTree(PieceTable *self, Piece *node) {
+    while (node) {
+        if (node->lchild) {
+            Piece *lchild = node->lchild;
+            node->lchild = lchild->rchild;
+            lchild->rchild = node;
+            node = lchild;
+        } else {
+            Piece *rchild = node->rchild;
+            Pool_free(self->pieces, node);
+            node = rchild;
+        }
+    }
+}
+
+/* Grows the piece of the previous insert by text, if pos is right after it,
+ * its text ends where the newest block does, and the block has room for
+ * text. This makes typing and appending cost no allocation at all.
+ *
+ * On success, zero is returned. Otherwise, -1 is returned and self is left
+ * unchanged. */
+static int growLast(PieceTable *self, int pos, const char *text, int len) {
+    Piece *last = self->last;
+    Block *block = self->blocks;
+    if (!last || (pos != self->last_end)) return -1;
+    if (last->text + last->len != block->text + block->used) return -1;
+    if (block->used + len > block->capacity) return -1;
+
+    memcpy(block->text + block->used, text, len);
+    block->used += len;
+
+    /* Descend to the piece, which holds pos - 1, growing the subtrees on the
+     * way. */
+    Piece *node = self->root;
+    int p = pos - 1;
+    while (node != last) {
+        int l_size = getSize(node->lchild);
+        node->size += len;
+        if (p < l_size) {
+            node = node->lchild;
+        } else {
+            p -= l_size + node->len;
+            node = node->rchild;
+        }
+    }
+    last->len += len;
+    last->size += len;
+
+    self->last_end += len;
+    return 0;
+}
+
+/* Splits the tree under node after p characters, cutting the piece that
+ * holds p in two if needed. Either result may be NULL, meaning that side is
+ * empty. */
+static void splitRecursive(PieceTable *self, Piece *node, int p,
+                           Piece **left, Piece **right) {
+    if (!node) {
+        *left = NULL;
+        *right = NULL;
+        return;
+    }
+
+    Piece *lchild = node->lchild;
+    Piece *rchild = node->rchild;
+    int l_size = getSize(lchild);
+
+    if (p <= l_size) {
+        Piece *middle;
+        splitRecursive(self, lchild, p, left, &middle);
+        *right = join3(middle, node, rchild);
+    } else if (p >= l_size + node->len) {
+        Piece *middle;
+        splitRecursive(self, rchild, p - l_size - node->len, &middle, right);
+        *left = join3(lchild, node, middle);
+    } else {
+        int cut = p - l_size;
+        Piece *tail = newPiece(self, node->text + cut, node->len - cut);
+        node->len = cut;
+        *left = join3(lchild, node, NULL);
+        *right = join3(NULL, tail, rchild);
+    }
+}
+
+/* Concatenates left, the single piece middle, and right, keeping the result
+ * balanced. */
+static Piece *join3(Piece *left, Piece *middle, Piece *right) {
+    if (getHeight(left) > getHeight(right) + 1) {
+        left->rchild = join3(left->rchild, middle, right);
+        return rebalance(left);
+    }
+
+    if (getHeight(right) > getHeight(left) + 1) {
+        right->lchild = join3(left, middle, right->lchild);
+        return rebalance(right);
+    }
+
+    middle->lchild = left;
+    middle->rchild = right;
+    updatePiece(middle);
+    return middle;
+}
+
+static Piece *join(Piece *left, Piece *right) {
+    if (!left) return right;
+    if (!right) return left;
+
+    Piece *first;
+    right = removeFirst(right, &first);
+    return join3(left, first, right);
+}
+
+/* Unlinks the first piece under node, and sets first to it.
+ *
+ * Returns the new root, which is NULL if node was the only piece. */
+static Piece *removeFirst(Piece *node, Piece **first) {
+    if (!node->lchild) {
+        *first = node;
+        return node->rchild;
+    }
+
+    node->lchild = removeFirst(node->lchild, first);
+    return rebalance(node);
+}
+
+/* Restores the AVL invariant on self, given that both of its subtrees are
+ * balanced and their heights differ by at most two. */
+static Piece *rebalance(Piece *self) {
+    int balance = getHeight(self->lchild) - getHeight(self->rchild);
+
+    if (balance > 1) {
+        Piece *lchild = self->lchild;
+        if (getHeight(lchild->lchild) < getHeight(lchild->rchild))
+            self->lchild = rotateLeft(lchild);
+        return rotateRight(self);
+    }
+
+    if (balance < -1) {
+        Piece *rchild = self->rchild;
+        if (getHeight(rchild->rchild) < getHeight(rchild->lchild))
+            self->rchild = rotateRight(rchild);
+        return rotateLeft(self);
+    }
+
+    updatePiece(self);
+    return self;
+}
+
+static Piece *rotateLeft(Piece *self) {
+    Piece *pivot = self->rchild;
+    self->rchild = pivot->lchild;
+    pivot->lchild = self;
+
+    updatePiece(self);
+    updatePiece(pivot);
+    return pivot;
+}
+
+static Piece *rotateRight(Piece *self) {
+    Piece *pivot = self->lchild;
+    self->lchild = pivot->rchild;
+    pivot->rchild = self;
+
+    updatePiece(self);
+    updatePiece(pivot);
+    return pivot;
+}
+
+/* Recomputes the cached size and height of self from its children. */
+static void updatePiece(Piece *self) {
+    int l_height = getHeight(self->lchild);
+    int r_height = getHeight(self->rchild);
+
+    self->size = getSize(self->lchild) + self->len + getSize(self->rchild);
+    self->height = 1 + (l_height > r_height ? l_height : r_height);
+}
+
+static int getHeight(const Piece *self) {
+    return self ? self->height : -1;
+}
+
+static int getSize(const Piece *self) {
+    return self ? self->size : 0;
+}
+
+static void pushLeftSpine(PieceTableIter *it, const Piece *self) {
+    for (; self; self = self->lchild) it->stack[it->top++] = self;
+}
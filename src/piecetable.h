@@ -0,0 +1,60 @@
+/* Piece table: the text is never moved once stored. The document is a
+ * sequence of pieces, each pointing at a span of an append-only buffer, kept
+ * in a balanced tree ordered by position.
+ *
+ * It offers the editing operations of rope.h, with the same semantics, for
+ * workloads where copying text is what costs the most. Only those are
+ * offered: it is a prototype for test/BENCH_rope.c, which compares it with
+ * the rope on the same edits, and the server cannot be built on it. It has
+ * no cursors, snapshots, line or character indexing, search, hashing,
+ * batches or freezing, which the server needs from rope.h. */
+
+#ifndef PIECETABLE_H
+#define PIECETABLE_H
+
+typedef struct PieceTable PieceTable;
+
+/* Deep enough for any balanced piece tree that fits in memory. */
+#define PIECE_TABLE_MAX_DEPTH 64
+
+/* Walks over the text of a piece table, one piece at a time, without copying
+ * it. */
+typedef struct {
+    const struct Piece *stack[PIECE_TABLE_MAX_DEPTH];
+    int top;
+} PieceTableIter;
+
+/* Creates a new empty piece table.
+ *
+ * On success, a pointer to the newly created piece table is returned. On
+ * error, NULL is returned. */
+PieceTable *PieceTable_new();
+
+/* Creates a new piece table holding the first len bytes of buf, which need
+ * not be null-terminated. buf is copied once, as a single piece.
+ *
+ * On success, a pointer to the newly created piece table is returned. On
+ * error, NULL is returned. */
+PieceTable *PieceTable_buildFrom(const char *buf, int len);
+
+void PieceTable_destroy(PieceTable *self);
+
+/* Same as Rope_insert and Rope_delete.
+ *
+ * On success, self is returned. If a position is out of range, NULL is
+ * returned and self is left unchanged. */
+PieceTable *PieceTable_insert(PieceTable *self, int pos, const char *text);
+PieceTable *PieceTable_delete(PieceTable *self, int begin, int end);
+
+/* Returns the length of the text held by self, in constant time. */
+int PieceTable_size(const PieceTable *self);
+
+/* Returns the contents of self as a null-terminated string, obtained with
+ * malloc. On error, NULL is returned. */
+char *PieceTable_toString(const PieceTable *self);
+
+/* Same as Rope_iterBegin and Rope_iterNext, one piece at a time. */
+void PieceTable_iterBegin(const PieceTable *self, PieceTableIter *it);
+int PieceTable_iterNext(PieceTableIter *it, const char **text, int *len);
+
+#endif
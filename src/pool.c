@@ -0,0 +1,122 @@
+/* Slab based allocator for objects of a single, fixed size. */
+
+#include "pool.h"
+#include <stdlib.h>
+
+#define POOL_ALIGNMENT 16
+#define POOL_FIRST_SLAB 4
+#define POOL_MAX_SLAB 256
+
+/* Slabs are chained through a header placed before their objects. Free
+ * objects are chained through their own first bytes. */
+typedef struct Slab { struct Slab *next; } Slab;
+typedef struct FreeObject { struct FreeObject *next; } FreeObject;
+
+struct Pool {
+    size_t object_size;
+    int slab_objects;
+    char *bump, *bump_end;
+    FreeObject *free_head, *free_tail;
+    Slab *slabs, *last_slab;
+};
+
+static size_t roundUp(size_t size);
+static int newSlab(Pool *self);
+
+Pool *Pool_new(size_t object_size) {
+    Pool *self = malloc(sizeof(Pool));
+    if (!self) return NULL;
+
+    if (object_size < sizeof(FreeObject)) object_size = sizeof(FreeObject);
+
+    *self = (Pool) {
+        .object_size = roundUp(object_size),
+        .slab_objects = POOL_FIRST_SLAB,
+        .bump = NULL, .bump_end = NULL,
+        .free_head = NULL, .free_tail = NULL,
+        .slabs = NULL, .last_slab = NULL
+    };
+    return self;
+}
+
+void Pool_destroy(Pool *self) {
+    if (!self) return;
+
+    Slab *slab = self->slabs;
+    while (slab) {
+        Slab *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    free(self);
+}
+
+void *Pool_alloc(Pool *self) {
+    if (self->free_head) {
+        FreeObject *object = self->free_head;
+        self->free_head = object->next;
+        if (!self->free_head) self->free_tail = NULL;
+        return object;
+    }
+
+    if ((self->bump == self->bump_end) && newSlab(self)) return NULL;
+
+    void *object = self->bump;
+    self->bump += self->object_size;
+    return object;
+}
+
+void Pool_free(Pool *self, void *object) {
+    FreeObject *cast = (FreeObject *) object;
+    cast->next = self->free_head;
+    self->free_head = cast;
+    if (!self->free_tail) self->free_tail = cast;
+}
+
+void Pool_merge(Pool *self, Pool *other) {
+    /* Whatever is left of the slab other was cutting from is not lost. */
+    while (other->bump != other->bump_end) {
+        Pool_free(other, other->bump);
+        other->bump += other->object_size;
+    }
+
+    if (other->slabs) {
+        other->last_slab->next = self->slabs;
+        self->slabs = other->slabs;
+        if (!self->last_slab) self->last_slab = other->last_slab;
+    }
+
+    if (other->free_head) {
+        other->free_tail->next = self->free_head;
+        self->free_head = other->free_head;
+        if (!self->free_tail) self->free_tail = other->free_tail;
+    }
+
+    if (other->slab_objects > self->slab_objects)
+        self->slab_objects = other->slab_objects;
+
+    free(other);
+}
+
+static size_t roundUp(size_t size) {
+    return (size + POOL_ALIGNMENT - 1) / POOL_ALIGNMENT * POOL_ALIGNMENT;
+}
+
+/* Allocates a new slab and points the bump pointer at it.
+ *
+ * On success, zero is returned. On error, -1 is returned. */
+static int newSlab(Pool *self) {
+    size_t header = roundUp(sizeof(Slab));
+    Slab *slab = malloc(header + self->slab_objects * self->object_size);
+    if (!slab) return -1;
+
+    slab->next = self->slabs;
+    self->slabs = slab;
+    if (!self->last_slab) self->last_slab = slab;
+
+    self->bump = (char *) slab + header;
+    self->bump_end = self->bump + self->slab_objects * self->object_size;
+
+    if (self->slab_objects < POOL_MAX_SLAB) self->slab_objects *= 2;
+    return 0;
+}
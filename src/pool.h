@@ -0,0 +1,39 @@
+/* Slab based allocator for objects of a single, fixed size. */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+typedef struct Pool Pool;
+
+/* Creates a new pool handing out objects of object_size bytes.
+ *
+ * On success, a pointer to the newly created pool is returned. On error,
+ * NULL is returned. */
+Pool *Pool_new(size_t object_size);
+
+/* Releases every slab of the pool at once, along with any object still
+ * allocated from it. */
+void Pool_destroy(Pool *self);
+
+/* Allocates one object.
+ *
+ * Freed objects are reused first. Otherwise the object is cut from the
+ * current slab by moving a pointer, and a new slab (twice as big as the last
+ * one, up to a limit) is only malloc'd when the current one runs out.
+ *
+ * On success, a pointer to the object is returned. On error, NULL is
+ * returned. */
+void *Pool_alloc(Pool *self);
+
+/* Gives object back to the pool, to be handed out again by Pool_alloc. */
+void Pool_free(Pool *self, void *object);
+
+/* Moves every slab and free object of other into self, and destroys other.
+ *
+ * Objects allocated from other remain valid, and are from then on owned by
+ * self. Both pools must have the same object size. */
+void Pool_merge(Pool *self, Pool *other);
+
+#endif
@@ -1,51 +1,289 @@
-/* Heap based implementation of the rope structure. */
+/* Heap based implementation of the rope structure.
+ *
+ * The tree is kept height balanced (AVL): every join descends the spine of
+ * the taller rope until heights match, and rotates on the way back up. A
+ * split is a sequence of such joins, so both stay O(log n). */
+
+#define _POSIX_C_SOURCE 200112L
 
 #include "rope.h"
+#include "pool.h"
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <unistd.h>
 
-typedef struct {
+/* Leaves are fixed capacity chunks. Small edits are done inside a chunk when
+ * it has room, and neighbouring chunks are merged on join when one of them
+ * is under the threshold and both fit in one. */
+#define ROPE_CHUNK_SIZE 512
+#define ROPE_MERGE_THRESHOLD (ROPE_CHUNK_SIZE / 2)
+
+/* Ropes at least this long are flattened by several threads at once, each
+ * copying a few whole subtrees. Splitting in more subtrees than threads
+ * evens out the work when the tree is lopsided. */
+#define ROPE_PARALLEL_SIZE (8 << 20)
+#define ROPE_MAX_THREADS 16
+#define ROPE_JOBS_PER_THREAD 4
+
+/* Text is hashed as a polynomial in a fixed base: the bytes c0 ... c(n-1)
+ * hash to the sum of (ci + 1) * B^(n-1-i), modulo the prime 2^61 - 1. So the
+ * hash of a concatenation follows from the hashes of its parts, given B^n
+ * for the right one. */
+#define ROPE_HASH_PRIME ((UINT64_C(1) << 61) - 1)
+#define ROPE_HASH_BASE UINT64_C(0x5bd1e995)
+
+/* Every allocation first gives back this many nodes of the subtrees waiting
+ * to be reclaimed, so they never pile up faster than the rope grows. */
+#define ROPE_RECLAIM_STEP 2
+
+/* On inner nodes, value is the weight (the size of the left subtree). On
+ * leaves, it is the length of text, which is not null-terminated. size is the
+ * length of the whole subtree, so it matches value on leaves. lines is the
+ * number of newlines in the subtree, and chars the number of UTF-8
+ * characters that start in it. hash is the hash of the text of the subtree,
+ * and power the base raised to its size, both modulo the hash prime. They
+ * are only computed when asked for: edits just zero power, which is never
+ * zero otherwise, on the nodes they touch.
+ *
+ * Leaves carry their chunk inline, and are allocated from a separate pool
+ * than inner nodes, which have no text at all. Leaves are never empty; the
+ * empty rope has no root.
+ *
+ * Nodes are reference counted so that snapshots can share them. A node is
+ * only modified while nothing else refers to it; otherwise it is copied
+ * first, along with the path leading to it. */
+typedef struct RopeNode {
+    struct RopeNode *lchild, *rchild;
     int value;
+    int size;
+    int lines;
+    int chars;
+    int height;
+    int refs;
+    uint64_t hash;
+    uint64_t power;
+    char text[];
+} RopeNode;
+
+/* dead holds the roots of subtrees nothing refers to anymore, whose nodes
+ * have not been given back to their pools yet. */
+typedef struct {
+    Pool *nodes;
+    Pool *leaves;
+    int refs;
+    RopeNode **dead;
+    int n_dead;
+    int dead_capacity;
+} RopePool;
+
+/* Collects the leaves of a rope being rebuilt, in order. New text is
+ * gathered in chunk until it fills a leaf. failed is set when memory runs
+ * out, after which nothing else is added. */
+typedef struct {
+    RopePool *pool;
+    RopeNode **leaves;
+    int len;
+    int capacity;
+    char chunk[ROPE_CHUNK_SIZE];
+    int chunk_len;
+    int failed;
+} LeafBuilder;
+
+/* An edit of Rope_applyBatch, in terms of the text before the batch: the
+ * range [begin, end) of it becomes text, which is len bytes long. */
+typedef struct {
+    int begin;
+    int end;
     char *text;
-} RopeContent;
+    int len;
+} RopeChange;
 
-static void deleteContent(void *content);
-static Rope *splitRecursive(Rope *self, int p);
-static Rope *splitLeaf(Rope *self, int p);
-static int getValue(const Rope *self);
-static void setValue(Rope *self, int value);
-static char *getText(const Rope *self);
-static void toStringRecurse(const Rope *self, char *s);
+/* A subtree to be copied whole, and where its text goes. */
+typedef struct {
+    const RopeNode *subtree;
+    char *dest;
+} FlattenJob;
+
+/* The run of jobs a single thread takes care of. */
+typedef struct {
+    const FlattenJob *jobs;
+    int len;
+} FlattenWork;
 
-static char *strdup(const char *self);
+/* A line start, at a position of the Eytzinger array of a frozen rope. */
+typedef struct {
+    int offset;
+    int line;
+} LineStart;
+
+/* The flat layout of Rope_freeze, allocated as a single block: this header,
+ * then the line starts in Eytzinger order (from index 1, so that the
+ * children of entry k are 2k and 2k + 1), then their offsets in order, then
+ * the text, null-terminated. */
+typedef struct {
+    int size;
+    int lines;
+    const LineStart *tree;
+    const int *starts;
+    const char *text;
+} RopeFrozen;
+
+/* stamp changes with every edit, telling cursors when their path is stale.
+ * frozen, when not NULL, holds the text as the tree has it now. */
+struct Rope {
+    RopeNode *root;
+    RopePool *pool;
+    unsigned int stamp;
+    RopeFrozen *frozen;
+};
+
+/* path[0] is the root, and path[depth - 1] the node the cursor is on. start
+ * holds the offset where the subtree of each of them begins. */
+struct RopeCursor {
+    Rope *rope;
+    unsigned int stamp;
+    int depth;
+    RopeNode *path[ROPE_MAX_DEPTH];
+    int start[ROPE_MAX_DEPTH];
+};
+
+static Rope *newRope(RopePool *pool, RopeNode *root);
+static void markEdited(Rope *self);
+static int fillEytzinger(LineStart *tree, const int *starts, int n, int i,
+                         int k);
+static int frozenLineAt(const RopeFrozen *self, int pos);
+static RopePool *newPool();
+static void releasePool(RopePool *self);
+static void adoptTree(Rope *self, Rope *other);
+static RopeNode *copyTree(RopePool *pool, const RopeNode *self);
+static RopeNode *newLeaf(RopePool *pool, const char *text, int len);
+static RopeNode *newLeaves(RopePool *pool, const char *text, int len);
+static RopeNode *newNode(RopePool *pool, RopeNode *lchild, RopeNode *rchild);
+static RopeNode *newBalanced(RopePool *pool, RopeNode **leaves, int n);
+static void builderAddLeaf(LeafBuilder *self, RopeNode *leaf);
+static void builderAddText(LeafBuilder *self, const char *text, int len);
+static void builderFlush(LeafBuilder *self);
+static void builderPush(LeafBuilder *self, RopeNode *leaf);
+static int addChange(const Rope *self, RopeChange *changes, int *n,
+                     int begin, int end, const char *text);
+static char *copySpan(const Rope *self, const RopeChange *changes, int n,
+                      int begin, int end, int lo, int hi, char *dest);
+static void applyChanges(Rope *self, const RopeChange *changes, int n);
+static void deleteNode(RopePool *pool, RopeNode *self);
+static void deleteTree(RopePool *pool, RopeNode *self);
+static void deleteNow(RopePool *pool, RopeNode *self);
+static int pushDead(RopePool *pool, RopeNode *self);
+static int reclaimTrees(RopePool *pool, int budget);
+static RopeNode *ownNode(RopePool *pool, RopeNode *self);
+static int isLeaf(const RopeNode *self);
+static void splitTree(RopePool *pool, RopeNode *self, int p,
+                      RopeNode **left, RopeNode **right);
+static int insertInPlace(RopePool *pool, RopeNode **self, int pos,
+                         const char *text, int len);
+static int deleteInPlace(RopePool *pool, RopeNode **self, int begin, int end);
+static RopeNode *joinMerging(RopePool *pool, RopeNode *l_rope,
+                             RopeNode *r_rope);
+static RopeNode *appendToLast(RopePool *pool, RopeNode *self,
+                              const char *text, int len);
+static RopeNode *dropFirstLeaf(RopePool *pool, RopeNode *self);
+static RopeNode *joinBalanced(RopePool *pool, RopeNode *l_rope,
+                              RopeNode *r_rope);
+static RopeNode *joinNullable(RopePool *pool, RopeNode *l_rope,
+                              RopeNode *r_rope);
+static RopeNode *rebalance(RopePool *pool, RopeNode *self);
+static RopeNode *rotateLeft(RopePool *pool, RopeNode *self);
+static RopeNode *rotateRight(RopePool *pool, RopeNode *self);
+static void updateNode(RopeNode *self);
+static int getHeight(const RopeNode *self);
+static int getSize(const RopeNode *self);
+static int getLines(const RopeNode *self);
+static int countNewlines(const char *text, int len);
+static int getChars(const RopeNode *self);
+static int countChars(const char *text, int len);
+static int isContinuation(char c);
+static void hashNode(RopeNode *self);
+static uint64_t prefixHash(RopeNode *self, int pos);
+static uint64_t hashText(const char *text, int len);
+static uint64_t hashPower(int len);
+static uint64_t mulMod(uint64_t a, uint64_t b);
+static uint64_t reduceMod(uint64_t x);
+static int lineStart(const RopeNode *self, int line);
+static int iterSeek(RopeIter *it, const RopeNode *self, int pos);
+static void copyRange(const RopeNode *self, int begin, int end, char *dest);
+static int matchesAt(const RopeIter *it, const char *text, int len,
+                     const char *pattern, int pattern_len);
+static void iterLeaves(RopeIter *it, const RopeNode *self);
+static void pushLeftSpine(RopeIter *it, const RopeNode *self);
+static void flattenParallel(const RopeNode *self, char *s);
+static int splitJobs(FlattenJob *jobs, int n, int max);
+static void *flattenWork(void *work);
+static void flattenSubtree(const RopeNode *self, char *dest);
+static RopeNode *seek(RopeCursor *self, int begin, int end);
+static void addAlongPath(RopeCursor *self, const char *text, int delta);
 
 Rope *Rope_new() {
-    return Rope_newFrom("");
+    RopePool *pool = newPool();
+    if (!pool) return NULL;
+
+    Rope *self = newRope(pool, NULL);
+    if (!self) releasePool(pool);
+    return self;
 }
 
 Rope *Rope_newFrom(const char *text) {
-    RopeContent *c = (RopeContent *) malloc(sizeof(RopeContent));
-    if (!c) return NULL;
+    return Rope_buildFrom(text, strlen(text));
+}
 
-    *c = (RopeContent) { .value = strlen(text), .text = strdup(text) };
-    if (!c->text) {
-        free(c);
+Rope *Rope_buildFrom(const char *buf, int len) {
+    if (len < 0) return NULL;
+
+    Rope *self = Rope_new();
+    if (!self) return NULL;
+    if (len == 0) return self;
+
+    self->root = newLeaves(self->pool, buf, len);
+    if (!self->root) {
+        Rope_destroy(self);
         return NULL;
     }
-
-    return BinaryTree_new(c, NULL, NULL);
+    return self;
 }
 
 void Rope_destroy(Rope *self) {
-    BinaryTree_delete(self, deleteContent);
+    if (!self) return;
+
+    /* Only walk the tree when its nodes must go back to a shared pool. */
+    if (self->pool->refs > 1) deleteTree(self->pool, self->root);
+    releasePool(self->pool);
+    free(self->frozen);
+    free(self);
+}
+
+int Rope_reclaim(Rope *self, int budget) {
+    return reclaimTrees(self->pool, budget);
 }
 
 Rope *Rope_insert(Rope *self, int pos, const char *text) {
     if (pos < 0) pos += Rope_size(self) + 1;
-    if (pos < 0) return NULL;
+    if ((pos < 0) || (pos > Rope_size(self))) return NULL;
 
-    Rope *right = Rope_split(self, pos);
-    return Rope_join(self, Rope_join(Rope_newFrom(text), right));
+    int len = strlen(text);
+    if (len == 0) return self;
+
+    markEdited(self);
+    if (self->root &&
+            (insertInPlace(self->pool, &(self->root), pos, text, len) == 0))
+        return self;
+
+    RopeNode *left, *right;
+    splitTree(self->pool, self->root, pos, &left, &right);
+
+    RopeNode *middle = newLeaves(self->pool, text, len);
+    self->root = joinMerging(self->pool,
+                             joinMerging(self->pool, left, middle), right);
+    return self;
 }
 
 Rope *Rope_delete(Rope *self, int begin, int end) {
@@ -53,142 +291,1660 @@ Rope *Rope_delete(Rope *self, int begin, int end) {
     if (end < 0) end += Rope_size(self) + 1;
 
     if ((begin < 0) || (end < 0) || (begin > end)) return NULL;
+    if (end > Rope_size(self)) return NULL;
+    if (begin == end) return self;
+
+    markEdited(self);
+    if ((end - begin < Rope_size(self)) &&
+            (deleteInPlace(self->pool, &(self->root), begin, end) == 0))
+        return self;
 
-    Rope *last = Rope_split(self, end);
-    Rope *middle = Rope_split(self, begin);
+    RopeNode *first, *middle, *last;
+    splitTree(self->pool, self->root, end, &first, &last);
+    splitTree(self->pool, first, begin, &first, &middle);
 
-    Rope_destroy(middle);
+    deleteTree(self->pool, middle);
 
-    return Rope_join(self, last);
+    self->root = joinMerging(self->pool, first, last);
+    return self;
 }
 
 Rope *Rope_split(Rope *self, int p) {
     if (p < 0) p += Rope_size(self) + 1;
-    if (p < 0) return NULL;
+    if ((p < 0) || (p > Rope_size(self))) return NULL;
+
+    /* Both sides keep allocating from the same pool. */
+    Rope *right = newRope(self->pool, NULL);
+    if (!right) return NULL;
+    self->pool->refs++;
+    markEdited(self);
 
-    return splitRecursive(self, p);
+    splitTree(self->pool, self->root, p, &(self->root), &(right->root));
+    return right;
 }
 
 Rope *Rope_join(Rope *l_rope, Rope *r_rope) {
-    /* If either rope is empty, delete it and return the other. */
-    if (0 == getValue(l_rope)) {
-        Rope_destroy(l_rope);
-        return r_rope;
+    adoptTree(l_rope, r_rope);
+    markEdited(l_rope);
+
+    l_rope->root = joinMerging(l_rope->pool, l_rope->root, r_rope->root);
+
+    releasePool(r_rope->pool);
+    free(r_rope->frozen);
+    free(r_rope);
+    return l_rope;
+}
+
+int Rope_applyBatch(Rope *self, const RopeEdit *edits, int n) {
+    RopeChange *changes = malloc((n > 0 ? n : 1) * sizeof(RopeChange));
+    if (!changes) return -1;
+
+    /* size is that of the text the next edit applies to. */
+    int size = Rope_size(self);
+    int n_changes = 0, applied = 0;
+    for (int i = 0; i < n; i++) {
+        int begin = edits[i].begin, end = edits[i].end;
+        if (begin < 0) begin += size + 1;
+        if (end < 0) end += size + 1;
+        if ((begin < 0) || (begin > end) || (end > size)) continue;
+
+        applied++;
+        int len = strlen(edits[i].text);
+        if ((begin == end) && (len == 0)) continue;
+
+        if (addChange(self, changes, &n_changes, begin, end, edits[i].text)) {
+            for (int j = 0; j < n_changes; j++) free(changes[j].text);
+            free(changes);
+            return -1;
+        }
+        size += len - (end - begin);
     }
 
-    if (0 == getValue(r_rope)) {
-        Rope_destroy(r_rope);
-        return l_rope;
+    if (n_changes > 0) applyChanges(self, changes, n_changes);
+
+    for (int i = 0; i < n_changes; i++) free(changes[i].text);
+    free(changes);
+    return applied;
+}
+
+int Rope_replaceAll(Rope *self, const char *pattern, const char *replacement) {
+    int pattern_len = strlen(pattern);
+    int replacement_len = strlen(replacement);
+
+    int match = Rope_find(self, pattern, 0);
+    if (match < 0) return 0;
+
+    LeafBuilder builder = {
+        .pool = self->pool, .leaves = NULL, .len = 0, .capacity = 0,
+        .chunk_len = 0, .failed = 0
+    };
+    int count = 0;
+
+    /* offset is where the current leaf starts, and pos the first of its
+     * bytes not handled yet; a match may have covered some of them. */
+    RopeIter it;
+    int offset = 0, pos = 0;
+    iterLeaves(&it, self->root);
+    while (it.top > 0) {
+        RopeNode *leaf = (RopeNode *) it.stack[it.top - 1];
+        const char *text;
+        int len;
+        Rope_iterNext(&it, &text, &len);
+        int end = offset + len;
+
+        if ((pos == offset) && ((match < 0) || (match >= end))) {
+            builderAddLeaf(&builder, leaf);
+            pos = offset = end;
+            continue;
+        }
+
+        while ((match >= 0) && (match < end)) {
+            builderAddText(&builder, text + (pos - offset), match - pos);
+            builderAddText(&builder, replacement, replacement_len);
+            count++;
+            pos = match + pattern_len;
+            match = Rope_find(self, pattern, pos);
+        }
+        if (pos < end) {
+            builderAddText(&builder, text + (pos - offset), end - pos);
+            pos = end;
+        }
+        offset = end;
+    }
+    builderFlush(&builder);
+
+    if (builder.failed) {
+        for (int i = 0; i < builder.len; i++)
+            deleteTree(self->pool, builder.leaves[i]);
+        free(builder.leaves);
+        return -1;
     }
 
-    /* Otherwise, join them with a new root. */
-    Rope *root = Rope_new();
+    RopeNode *root = builder.len ?
+        newBalanced(self->pool, builder.leaves, builder.len) : NULL;
+    free(builder.leaves);
 
-    setValue(root, Rope_size(l_rope));
-    BinaryTree_insertLeft(root, l_rope);
+    deleteTree(self->pool, self->root);
+    self->root = root;
+    markEdited(self);
+    return count;
+}
 
-    BinaryTree_insertRight(root, r_rope);
+Rope *Rope_snapshot(Rope *self) {
+    Rope *copy = newRope(self->pool, self->root);
+    if (!copy) return NULL;
 
-    return root;
+    self->pool->refs++;
+    if (self->root) self->root->refs++;
+
+    /* The nodes are now shared, so cursors must copy them before editing. */
+    self->stamp++;
+    return copy;
+}
+
+int Rope_freeze(Rope *self) {
+    if (self->frozen) return 0;
+
+    int size = Rope_size(self), lines = Rope_lines(self);
+    size_t header = sizeof(RopeFrozen) + (lines + 1) * sizeof(LineStart);
+    RopeFrozen *frozen = malloc(header + lines * sizeof(int) + size + 1);
+    if (!frozen) return -1;
+
+    LineStart *tree = (LineStart *) (frozen + 1);
+    int *starts = (int *) (tree + lines + 1);
+    char *text = (char *) (starts + lines);
+    *frozen = (RopeFrozen) {
+        .size = size, .lines = lines, .tree = tree, .starts = starts,
+        .text = text
+    };
+
+    if (size < ROPE_PARALLEL_SIZE) copyRange(self->root, 0, size, text);
+    else flattenParallel(self->root, text);
+    text[size] = '\0';
+
+    starts[0] = 0;
+    const char *p = text, *end = text + size;
+    for (int i = 1; i < lines; i++) {
+        p = (const char *) memchr(p, '\n', end - p) + 1;
+        starts[i] = p - text;
+    }
+    fillEytzinger(tree, starts, lines, 0, 1);
+
+    self->frozen = frozen;
+    return 0;
 }
 
 int Rope_size(const Rope *self) {
-    /* If self is null. */
-    if (self == NULL) return 0;
+    return getSize(self->root);
+}
 
-    /* If this is a leaf. */
-    if (BinaryTree_isLeaf(self)) {
-        if (!getText(self)) return 0;
-        return strlen(getText(self));
+int Rope_lines(const Rope *self) {
+    return getLines(self->root) + 1;
+}
+
+int Rope_lineOffset(const Rope *self, int line, int column) {
+    if ((line < 0) || (line >= Rope_lines(self)) || (column < 0)) return -1;
+
+    const RopeFrozen *frozen = self->frozen;
+    if (frozen) {
+        int begin = frozen->starts[line];
+        int end = (line + 1 < frozen->lines) ?
+            frozen->starts[line + 1] - 1 : frozen->size;
+        return (column > end - begin) ? -1 : begin + column;
     }
 
-    return getValue(self) + Rope_size(BinaryTree_rchild(self));
+    int begin = lineStart(self->root, line);
+    int end = (line + 1 < Rope_lines(self)) ?
+        lineStart(self->root, line + 1) - 1 : Rope_size(self);
+
+    if (column > end - begin) return -1;
+    return begin + column;
+}
+
+int Rope_lineAt(const Rope *self, int pos) {
+    if ((pos < 0) || (pos > Rope_size(self))) return -1;
+    if (self->frozen) return frozenLineAt(self->frozen, pos);
+    if (!self->root) return 0;
+
+    /* Count the newlines before pos. */
+    const RopeNode *node = self->root;
+    int line = 0;
+    while (!isLeaf(node)) {
+        if (pos <= node->value) {
+            node = node->lchild;
+        } else {
+            line += node->lchild->lines;
+            pos -= node->value;
+            node = node->rchild;
+        }
+    }
+    return line + countNewlines(node->text, pos);
+}
+
+int Rope_chars(const Rope *self) {
+    return getChars(self->root);
+}
+
+int Rope_charOffset(const Rope *self, int index) {
+    if ((index < 0) || (index > Rope_chars(self))) return -1;
+    if (index == Rope_chars(self)) return Rope_size(self);
+
+    const RopeNode *node = self->root;
+    int offset = 0;
+    while (!isLeaf(node)) {
+        if (index < node->lchild->chars) {
+            node = node->lchild;
+        } else {
+            index -= node->lchild->chars;
+            offset += node->value;
+            node = node->rchild;
+        }
+    }
+
+    /* The leaf holds the start of the character, past index others. */
+    int i = 0;
+    for (;; i++)
+        if (!isContinuation(node->text[i]) && (index-- == 0)) break;
+    return offset + i;
+}
+
+int Rope_charIndex(const Rope *self, int pos) {
+    if ((pos < 0) || (pos > Rope_size(self))) return -1;
+    if (!self->root) return 0;
+
+    /* Count the characters that start before pos. */
+    const RopeNode *node = self->root;
+    int index = 0;
+    while (!isLeaf(node)) {
+        if (pos <= node->value) {
+            node = node->lchild;
+        } else {
+            index += node->lchild->chars;
+            pos -= node->value;
+            node = node->rchild;
+        }
+    }
+    return index + countChars(node->text, pos);
+}
+
+int Rope_hash(Rope *self, int begin, int end, uint64_t *hash) {
+    if ((begin < 0) || (begin > end) || (end > Rope_size(self))) return -1;
+
+    /* Taking the hash of the text before begin, shifted past the range, out
+     * of the hash of the text before end leaves that of the range. */
+    uint64_t tail = prefixHash(self->root, end);
+    uint64_t head = begin ?
+        mulMod(prefixHash(self->root, begin), hashPower(end - begin)) : 0;
+    *hash = reduceMod(tail + ROPE_HASH_PRIME - head);
+    return 0;
 }
 
 char *Rope_toString(const Rope *self) {
-    int size = Rope_size(self) + 1;
-    char *s = (char *) malloc(size);
+    if (self->frozen || (Rope_size(self) < ROPE_PARALLEL_SIZE))
+        return Rope_substring(self, 0, Rope_size(self));
+
+    char *s = (char *) malloc(Rope_size(self) + 1);
     if (!s) return NULL;
 
-    toStringRecurse(self, s);
-    s[size - 1] = '\0';
+    flattenParallel(self->root, s);
+    s[Rope_size(self)] = '\0';
     return s;
 }
 
-static void deleteContent(void *self) {
-    RopeContent *cast = (RopeContent *) self;
-    if (cast->text != NULL) free(cast->text);
-    free(cast);
+char *Rope_substring(const Rope *self, int begin, int end) {
+    if ((begin < 0) || (begin > end) || (end > Rope_size(self))) return NULL;
+
+    char *s = (char *) malloc(end - begin + 1);
+    if (!s) return NULL;
+
+    if (self->frozen) memcpy(s, self->frozen->text + begin, end - begin);
+    else copyRange(self->root, begin, end, s);
+    s[end - begin] = '\0';
+    return s;
 }
 
-static Rope *splitRecursive(Rope *self, int p) {
-    if (BinaryTree_isLeaf(self)) return splitLeaf(self, p);
+int Rope_find(const Rope *self, const char *pattern, int from) {
+    int pattern_len = strlen(pattern);
+    if ((from < 0) || (from > Rope_size(self)) || (pattern_len == 0))
+        return -1;
 
-    if (p < getValue(self)) {
-        Rope *rchild = BinaryTree_extractRight(self);
+    RopeIter it;
+    const char *text;
+    int len;
+    int skip = Rope_iterSeek(self, &it, from);
+    int offset = from - skip;
 
-        int original_value = getValue(self);
-        Rope *left_result = splitRecursive(BinaryTree_lchild(self), p);
-        setValue(self, original_value - Rope_size(left_result));
-        return Rope_join(left_result, rchild);
-    } else if (p > getValue(self)) {
-        return splitRecursive(BinaryTree_rchild(self), p - getValue(self));
+    /* memchr finds candidates for the first byte, and only those are
+     * compared against the rest of the pattern. */
+    while (Rope_iterNext(&it, &text, &len)) {
+        const char *end = text + len;
+        const char *p = text + skip;
+        while ((p < end) && (p = memchr(p, pattern[0], end - p))) {
+            if (matchesAt(&it, p, end - p, pattern, pattern_len))
+                return offset + (p - text);
+            p++;
+        }
+        offset += len;
+        skip = 0;
     }
+    return -1;
+}
+
+void Rope_iterBegin(const Rope *self, RopeIter *it) {
+    if (self->frozen) {
+        Rope_iterSeek(self, it, 0);
+        return;
+    }
+
+    iterLeaves(it, self->root);
+}
 
-    return BinaryTree_extractRight(self);
+int Rope_iterSeek(const Rope *self, RopeIter *it, int pos) {
+    if ((pos < 0) || (pos > Rope_size(self))) return -1;
+    if (!self->frozen) return iterSeek(it, self->root, pos);
+
+    it->top = 0;
+    it->flat = self->frozen->size ? self->frozen->text : NULL;
+    it->flat_len = self->frozen->size;
+    return pos;
 }
 
-static Rope *splitLeaf(Rope *self, int p) {
-    if (p < 0) return NULL;
+int Rope_iterNext(RopeIter *it, const char **text, int *len) {
+    if (it->flat) {
+        *text = it->flat;
+        *len = it->flat_len;
+        it->flat = NULL;
+        return 1;
+    }
+    if (it->top == 0) return 0;
+
+    const RopeNode *leaf = it->stack[--it->top];
+    *text = leaf->text;
+    *len = leaf->value;
+
+    /* The stack holds the leaf's ancestors whose left side is pending, so
+     * the next leaf is the leftmost one under the closest of them. */
+    if (it->top > 0) {
+        const RopeNode *parent = it->stack[--it->top];
+        pushLeftSpine(it, parent->rchild);
+    }
+    return 1;
+}
+
+RopeCursor *RopeCursor_new(Rope *rope) {
+    RopeCursor *self = malloc(sizeof(RopeCursor));
+    if (!self) return NULL;
+
+    self->rope = rope;
+    self->stamp = rope->stamp;
+    self->depth = 0;
+    return self;
+}
+
+void RopeCursor_destroy(RopeCursor *self) {
+    free(self);
+}
+
+int RopeCursor_insert(RopeCursor *self, int pos, const char *text) {
+    Rope *rope = self->rope;
+    if (pos < 0) pos += Rope_size(rope) + 1;
+    if ((pos < 0) || (pos > Rope_size(rope))) return -1;
 
-    char *text = getText(self);
     int len = strlen(text);
-    if (p > len) return NULL;
+    RopeNode *leaf = rope->root ? seek(self, pos, pos) : NULL;
+    if (!leaf || (leaf->value + len > ROPE_CHUNK_SIZE))
+        return Rope_insert(rope, pos, text) ? 0 : -1;
+
+    char *dest = leaf->text + (pos - self->start[self->depth - 1]);
+    memmove(dest + len, dest, leaf->text + leaf->value - dest);
+    memcpy(dest, text, len);
+    addAlongPath(self, text, len);
+    return 0;
+}
+
+int RopeCursor_delete(RopeCursor *self, int begin, int end) {
+    Rope *rope = self->rope;
+    if (begin < 0) begin += Rope_size(rope) + 1;
+    if (end < 0) end += Rope_size(rope) + 1;
+
+    if ((begin < 0) || (end < 0) || (begin > end)) return -1;
+    if (end > Rope_size(rope)) return -1;
+    if (begin == end) return 0;
+
+    /* The range must lie in one leaf, which has to stay above the merge
+     * threshold unless it is the whole rope. */
+    RopeNode *leaf = seek(self, begin, end);
+    int remaining = leaf->value - (end - begin);
+    if (!isLeaf(leaf) || (remaining == 0) ||
+            ((self->depth > 1) && (remaining < ROPE_MERGE_THRESHOLD)))
+        return Rope_delete(rope, begin, end) ? 0 : -1;
+
+    char *dest = leaf->text + (begin - self->start[self->depth - 1]);
+    int tail = leaf->text + leaf->value - dest - (end - begin);
+    addAlongPath(self, dest, -(end - begin));
+    memmove(dest, dest + (end - begin), tail);
+    return 0;
+}
+
+static Rope *newRope(RopePool *pool, RopeNode *root) {
+    Rope *self = malloc(sizeof(Rope));
+    if (!self) return NULL;
+
+    *self = (Rope) {
+        .root = root, .pool = pool, .stamp = 0, .frozen = NULL
+    };
+    return self;
+}
+
+/* Tells cursors that self changed, and drops its flat layout. */
+static void markEdited(Rope *self) {
+    self->stamp++;
+    free(self->frozen);
+    self->frozen = NULL;
+}
+
+/* Fills the subtree of entry k of tree, in Eytzinger order, with the line
+ * starts of starts from index i on, going over it in order. n is the number
+ * of line starts.
+ *
+ * Returns the index of the first line start left. */
+static int fillEytzinger(LineStart *tree, const int *starts, int n, int i,
+                         int k) {
+    if (k > n) return i;
+
+    i = fillEytzinger(tree, starts, n, i, 2 * k);
+    tree[k] = (LineStart) { .offset = starts[i], .line = i };
+    return fillEytzinger(tree, starts, n, i + 1, 2 * k + 1);
+}
+
+/* Same as Rope_lineAt, on the flat layout. The line holding pos is the one
+ * before the first that starts after it. The descent takes the same number
+ * of steps whatever pos is, and picks a side with a comparison rather than
+ * a branch; the trailing right turns are then undone to find the entry where
+ * it last turned left. */
+static int frozenLineAt(const RopeFrozen *self, int pos) {
+    int k = 1;
+    while (k <= self->lines) k = 2 * k + (self->tree[k].offset <= pos);
+    while (k & 1) k >>= 1;
+    k >>= 1;
+
+    return (k ? self->tree[k].line : self->lines) - 1;
+}
+
+static RopePool *newPool() {
+    RopePool *self = malloc(sizeof(RopePool));
+    if (!self) return NULL;
+
+    *self = (RopePool) {
+        .nodes = Pool_new(sizeof(RopeNode)),
+        .leaves = Pool_new(sizeof(RopeNode) + ROPE_CHUNK_SIZE),
+        .refs = 1,
+        .dead = NULL, .n_dead = 0, .dead_capacity = 0
+    };
+    if (!self->nodes || !self->leaves) {
+        releasePool(self);
+        return NULL;
+    }
+    return self;
+}
+
+/* Drops a reference to self, releasing all of its slabs with the last one. */
+static void releasePool(RopePool *self) {
+    if (--self->refs > 0) return;
+
+    Pool_destroy(self->nodes);
+    Pool_destroy(self->leaves);
+    free(self->dead);
+    free(self);
+}
+
+/* Makes the nodes of other belong to the pool of self.
+ *
+ * When other is the only user of its pool, the pools are merged without
+ * touching the nodes. Otherwise the tree of other is copied. In both cases
+ * other keeps a reference to a pool that can be released afterwards. */
+static void adoptTree(Rope *self, Rope *other) {
+    if (self->pool == other->pool) return;
 
-    Rope *ret = Rope_newFrom(text + p);
-    text[p] = '\0';
-    setValue(self, strlen(text));
-    return ret;
+    if (other->pool->refs == 1) {
+        Pool_merge(self->pool->nodes, other->pool->nodes);
+        Pool_merge(self->pool->leaves, other->pool->leaves);
+
+        /* So do the subtrees other was yet to reclaim. */
+        RopePool *pool = other->pool;
+        for (int i = 0; i < pool->n_dead; i++)
+            if (pushDead(self->pool, pool->dead[i]))
+                deleteNow(self->pool, pool->dead[i]);
+        free(pool->dead);
+        free(pool);
+    } else {
+        RopeNode *copy = copyTree(self->pool, other->root);
+        deleteTree(other->pool, other->root);
+        releasePool(other->pool);
+        other->root = copy;
+    }
+
+    other->pool = self->pool;
+    self->pool->refs++;
+}
+
+static RopeNode *copyTree(RopePool *pool, const RopeNode *self) {
+    if (!self) return NULL;
+
+    /* Nodes are copied after their children: pending holds the nodes still
+     * to visit, at most two per level, and copies the finished subtrees. */
+    const RopeNode *pending[2 * ROPE_MAX_DEPTH + 1];
+    int expanded[2 * ROPE_MAX_DEPTH + 1];
+    RopeNode *copies[ROPE_MAX_DEPTH + 1];
+    int top = 0, n_copies = 0;
+
+    pending[top] = self;
+    expanded[top++] = 0;
+    while (top > 0) {
+        const RopeNode *node = pending[top - 1];
+        if (isLeaf(node)) {
+            copies[n_copies++] = newLeaf(pool, node->text, node->value);
+            top--;
+        } else if (!expanded[top - 1]) {
+            expanded[top - 1] = 1;
+            pending[top] = node->rchild;
+            expanded[top++] = 0;
+            pending[top] = node->lchild;
+            expanded[top++] = 0;
+        } else {
+            RopeNode *rchild = copies[--n_copies];
+            RopeNode *lchild = copies[--n_copies];
+            copies[n_copies++] = newNode(pool, lchild, rchild);
+            top--;
+        }
+    }
+    return copies[0];
 }
 
-static int getValue(const Rope *self) {
-    RopeContent *c = (RopeContent *) BinaryTree_getLiveContent(self);
-    return c->value;
+/* Creates a leaf holding a copy of the first len bytes of text, which must
+ * fit in a chunk. */
+static RopeNode *newLeaf(RopePool *pool, const char *text, int len) {
+    reclaimTrees(pool, ROPE_RECLAIM_STEP);
+    RopeNode *self = Pool_alloc(pool->leaves);
+    if (!self) return NULL;
+
+    *self = (RopeNode) {
+        .lchild = NULL, .rchild = NULL,
+        .value = len, .size = len, .lines = countNewlines(text, len),
+        .chars = countChars(text, len), .height = 0, .refs = 1
+    };
+    memcpy(self->text, text, len);
+    return self;
 }
 
-static void setValue(Rope *self, int value) {
-    RopeContent *c =(RopeContent *) BinaryTree_getLiveContent(self);
-    c->value = value;
+/* Cuts text in chunks and builds a balanced tree over them, halving the
+ * number of chunks at each level. */
+static RopeNode *newLeaves(RopePool *pool, const char *text, int len) {
+    if (len <= ROPE_CHUNK_SIZE) return newLeaf(pool, text, len);
+
+    int chunks = (len + ROPE_CHUNK_SIZE - 1) / ROPE_CHUNK_SIZE;
+    int l_len = (chunks / 2) * ROPE_CHUNK_SIZE;
+    return newNode(pool, newLeaves(pool, text, l_len),
+                   newLeaves(pool, text + l_len, len - l_len));
 }
 
-static char *getText(const Rope *self) {
-    RopeContent *c = (RopeContent *) BinaryTree_getLiveContent(self);
-    return c->text;
+/* Creates an inner node over lchild and rchild. */
+static RopeNode *newNode(RopePool *pool, RopeNode *lchild, RopeNode *rchild) {
+    reclaimTrees(pool, ROPE_RECLAIM_STEP);
+    RopeNode *self = Pool_alloc(pool->nodes);
+    if (!self) return NULL;
+
+    *self = (RopeNode) { .lchild = lchild, .rchild = rchild, .refs = 1 };
+    updateNode(self);
+    return self;
 }
 
-static void toStringRecurse(const Rope *self, char *s) {
-    /* NULL pointer. */
-    if (self == NULL) return;
+/* Builds a balanced tree over the n leaves, halving them at each level. */
+static RopeNode *newBalanced(RopePool *pool, RopeNode **leaves, int n) {
+    if (n == 1) return leaves[0];
 
-    /* Leaf. */
-    if (BinaryTree_isLeaf(self)) {
-        /* Empty leaf. */
-        if (getText(self) == NULL) return;
+    return newNode(pool, newBalanced(pool, leaves, n / 2),
+                   newBalanced(pool, leaves + n / 2, n - n / 2));
+}
 
-        /* Non empty leaf. */
-        strcpy(s, getText(self));
+/* Adds leaf to the rope being built, sharing it. If the text gathered so
+ * far is not a leaf yet and leaf fits along with it, leaf is copied there
+ * instead, so no leaf is left half empty. */
+static void builderAddLeaf(LeafBuilder *self, RopeNode *leaf) {
+    if ((self->chunk_len > 0) &&
+            (self->chunk_len + leaf->value <= ROPE_CHUNK_SIZE)) {
+        builderAddText(self, leaf->text, leaf->value);
         return;
     }
 
-    /* Recurse. */
-    toStringRecurse(BinaryTree_lchild(self), s);
-    toStringRecurse(BinaryTree_rchild(self), s + getValue(self));
+    builderFlush(self);
+    leaf->refs++;
+    builderPush(self, leaf);
+}
+
+static void builderAddText(LeafBuilder *self, const char *text, int len) {
+    while (len > 0) {
+        int n = ROPE_CHUNK_SIZE - self->chunk_len;
+        if (n > len) n = len;
+
+        memcpy(self->chunk + self->chunk_len, text, n);
+        self->chunk_len += n;
+        text += n;
+        len -= n;
+        if (self->chunk_len == ROPE_CHUNK_SIZE) builderFlush(self);
+    }
+}
+
+/* Turns the text gathered so far into a leaf. */
+static void builderFlush(LeafBuilder *self) {
+    if (self->chunk_len == 0) return;
+
+    RopeNode *leaf = newLeaf(self->pool, self->chunk, self->chunk_len);
+    self->chunk_len = 0;
+    if (!leaf) {
+        self->failed = 1;
+        return;
+    }
+    builderPush(self, leaf);
+}
+
+static void builderPush(LeafBuilder *self, RopeNode *leaf) {
+    if (self->failed) {
+        deleteTree(self->pool, leaf);
+        return;
+    }
+
+    if (self->len == self->capacity) {
+        int capacity = self->capacity ? 2 * self->capacity : 64;
+        RopeNode **leaves = realloc(self->leaves,
+                                    capacity * sizeof(RopeNode *));
+        if (!leaves) {
+            self->failed = 1;
+            deleteTree(self->pool, leaf);
+            return;
+        }
+        self->leaves = leaves;
+        self->capacity = capacity;
+    }
+    self->leaves[self->len++] = leaf;
+}
+
+/* Adds to the n sorted changes an edit of the range [begin, end) of the text
+ * they leave, which becomes text. The changes the edit overlaps or touches
+ * are merged with it into one, which holds what is left of their text.
+ *
+ * On success, zero is returned. On error, -1 is returned and changes are
+ * left unchanged. */
+static int addChange(const Rope *self, RopeChange *changes, int *n,
+                     int begin, int end, const char *text) {
+    /* The changes from first to last - 1 are the ones the edit reaches.
+     * Those before first move the text after them by delta, and those before
+     * last by after. */
+    int first = 0, delta = 0;
+    while ((first < *n) &&
+            (changes[first].begin + delta + changes[first].len < begin)) {
+        delta += changes[first].len -
+            (changes[first].end - changes[first].begin);
+        first++;
+    }
+    int last = first, after = delta;
+    while ((last < *n) && (changes[last].begin + after <= end)) {
+        after += changes[last].len - (changes[last].end - changes[last].begin);
+        last++;
+    }
+
+    /* The merged change spans [from, to) of the text as it is now. */
+    int from = begin, to = end;
+    if (last > first) {
+        if (changes[first].begin + delta < from)
+            from = changes[first].begin + delta;
+        if (changes[last - 1].end + after > to)
+            to = changes[last - 1].end + after;
+    }
+
+    int len = strlen(text);
+    RopeChange merged = {
+        .begin = from - delta, .end = to - after,
+        .len = (to - from) - (end - begin) + len
+    };
+    merged.text = malloc(merged.len + 1);
+    if (!merged.text) return -1;
+
+    /* Only what is left of [from, to) as it is now goes around text: the
+     * part the edit deletes is never copied. */
+    char *dest = copySpan(self, changes + first, last - first, merged.begin,
+                          merged.end, 0, begin - from, merged.text);
+    memcpy(dest, text, len);
+    copySpan(self, changes + first, last - first, merged.begin, merged.end,
+             end - from, to - from, dest + len);
+
+    /* A change that ends up doing nothing is dropped. */
+    for (int i = first; i < last; i++) free(changes[i].text);
+    int keep = (merged.len > 0) || (merged.end > merged.begin);
+    if (!keep) free(merged.text);
+
+    memmove(changes + first + keep, changes + last,
+            (*n - last) * sizeof(RopeChange));
+    if (keep) changes[first] = merged;
+    *n += keep - (last - first);
+    return 0;
+}
+
+/* Copies to dest the bytes [lo, hi) of the range [begin, end) of the text
+ * before the batch, as the n changes, which lie in that range, leave it.
+ * Offsets lo and hi count from where the range starts.
+ *
+ * Returns dest moved past the bytes copied. */
+static char *copySpan(const Rope *self, const RopeChange *changes, int n,
+                      int begin, int end, int lo, int hi, char *dest) {
+    /* at is where the next piece starts, the text kept before a change or
+     * the text of the change, and pos where the text kept starts. */
+    int at = 0, pos = begin;
+    for (int i = 0; (i <= n) && (at < hi); i++) {
+        int kept = ((i < n) ? changes[i].begin : end) - pos;
+        int a = (lo > at) ? lo : at;
+        int b = (hi < at + kept) ? hi : at + kept;
+        if (a < b) {
+            copyRange(self->root, pos + a - at, pos + b - at, dest);
+            dest += b - a;
+        }
+        at += kept;
+        if (i == n) break;
+
+        a = (lo > at) ? lo : at;
+        b = (hi < at + changes[i].len) ? hi : at + changes[i].len;
+        if (a < b) {
+            memcpy(dest, changes[i].text + a - at, b - a);
+            dest += b - a;
+        }
+        at += changes[i].len;
+        pos = changes[i].end;
+    }
+    return dest;
+}
+
+/* Makes the n sorted changes to self, from left to right. The part of the
+ * tree before each change is split off once and joined onto the result. */
+static void applyChanges(Rope *self, const RopeChange *changes, int n) {
+    RopeNode *done = NULL, *rest = self->root;
+    int offset = 0;
+
+    for (int i = 0; i < n; i++) {
+        RopeNode *before, *removed;
+        splitTree(self->pool, rest, changes[i].begin - offset, &before, &rest);
+        splitTree(self->pool, rest, changes[i].end - changes[i].begin,
+                  &removed, &rest);
+        deleteTree(self->pool, removed);
+
+        RopeNode *inserted = changes[i].len ?
+            newLeaves(self->pool, changes[i].text, changes[i].len) : NULL;
+        done = joinMerging(self->pool,
+                           joinMerging(self->pool, done, before), inserted);
+        offset = changes[i].end;
+    }
+
+    self->root = joinMerging(self->pool, done, rest);
+    markEdited(self);
+}
+
+/* Gives a single node back to its pool, ignoring its children. */
+static void deleteNode(RopePool *pool, RopeNode *self) {
+    Pool_free(isLeaf(self) ? pool->leaves : pool->nodes, self);
+}
+
+/* Drops a reference to self. With the last one, a leaf is deleted right
+ * away, and a larger subtree is queued on the pool for reclaimTrees to give
+ * back a few nodes at a time, so that dropping it costs O(1) whatever its
+ * size. If the queue cannot grow, the subtree is deleted right away too. */
+static void deleteTree(RopePool *pool, RopeNode *self) {
+    if (!self || (--self->refs > 0)) return;
+
+    if (isLeaf(self) || pushDead(pool, self)) deleteNow(pool, self);
+}
+
+/* Deletes self, which nothing refers to, along with the nodes of its subtree
+ * that nothing else refers to.
+ *
+ * Pending right subtrees are kept on an explicit stack, one per level at
+ * most, so the depth of the tree never reaches the call stack. */
+static void deleteNow(RopePool *pool, RopeNode *self) {
+    RopeNode *pending[ROPE_MAX_DEPTH + 1];
+    int top = 0;
+
+    pending[top++] = self->rchild;
+    pending[top++] = self->lchild;
+    deleteNode(pool, self);
+    while (top > 0) {
+        RopeNode *node = pending[--top];
+        if (!node || (--node->refs > 0)) continue;
+
+        pending[top++] = node->rchild;
+        pending[top++] = node->lchild;
+        deleteNode(pool, node);
+    }
+}
+
+/* Queues self, which nothing refers to, to be reclaimed.
+ *
+ * On success, zero is returned. On error, -1 is returned. */
+static int pushDead(RopePool *pool, RopeNode *self) {
+    if (pool->n_dead == pool->dead_capacity) {
+        int capacity = pool->dead_capacity ? 2 * pool->dead_capacity : 64;
+        RopeNode **dead = realloc(pool->dead, capacity * sizeof(RopeNode *));
+        if (!dead) return -1;
+        pool->dead = dead;
+        pool->dead_capacity = capacity;
+    }
+
+    pool->dead[pool->n_dead++] = self;
+    return 0;
+}
+
+/* Gives back to their pools up to budget nodes of the queued subtrees. The
+ * children of a node given back that nothing else refers to are queued in
+ * its place, so subtrees are taken apart from the top down.
+ *
+ * Returns the number of nodes given back. */
+static int reclaimTrees(RopePool *pool, int budget) {
+    int freed = 0;
+    while ((pool->n_dead > 0) && (freed < budget)) {
+        RopeNode *node = pool->dead[--pool->n_dead];
+        RopeNode *children[2] = { node->lchild, node->rchild };
+        deleteNode(pool, node);
+        freed++;
+
+        for (int i = 0; i < 2; i++) {
+            RopeNode *child = children[i];
+            if (child && (--child->refs == 0) && pushDead(pool, child))
+                deleteNow(pool, child);
+        }
+    }
+    return freed;
+}
+
+/* Returns a node equal to self that nothing else refers to, copying self if
+ * it is shared. The reference the caller had to self is moved to the result.
+ * The children of a copy gain a reference, so they are shared in turn. */
+static RopeNode *ownNode(RopePool *pool, RopeNode *self) {
+    if (self->refs == 1) return self;
+
+    RopeNode *copy;
+    if (isLeaf(self)) {
+        copy = newLeaf(pool, self->text, self->value);
+    } else {
+        copy = newNode(pool, self->lchild, self->rchild);
+        self->lchild->refs++;
+        self->rchild->refs++;
+    }
+
+    self->refs--;
+    return copy;
+}
+
+static int isLeaf(const RopeNode *self) {
+    return (NULL == self->lchild) && (NULL == self->rchild);
+}
+
+/* Splits self after p characters, consuming it. Either result may be NULL,
+ * meaning that side is empty.
+ *
+ * The inner nodes on the way down to p are taken apart, and the subtrees
+ * they leave on each side are stacked. Both sides are then joined back
+ * from the bottom up, smallest subtrees first, which keeps the total cost
+ * of the joins O(log n). */
+static void splitTree(RopePool *pool, RopeNode *self, int p,
+                      RopeNode **left, RopeNode **right) {
+    RopeNode *lefts[ROPE_MAX_DEPTH], *rights[ROPE_MAX_DEPTH];
+    int n_lefts = 0, n_rights = 0;
+
+    *left = NULL;
+    *right = NULL;
+    while (self) {
+        self = ownNode(pool, self);
+        if (isLeaf(self)) {
+            if (p == 0) {
+                *right = self;
+            } else if (p >= self->value) {
+                *left = self;
+            } else {
+                *right = newLeaf(pool, self->text + p, self->value - p);
+                self->value = self->size = p;
+                self->lines -= (*right)->lines;
+                self->chars -= (*right)->chars;
+                self->power = 0;
+                *left = self;
+            }
+            break;
+        }
+
+        int value = self->value;
+        RopeNode *lchild = self->lchild;
+        RopeNode *rchild = self->rchild;
+        deleteNode(pool, self);
+
+        if (p < value) {
+            rights[n_rights++] = rchild;
+            self = lchild;
+        } else if (p > value) {
+            lefts[n_lefts++] = lchild;
+            self = rchild;
+            p -= value;
+        } else {
+            *left = lchild;
+            *right = rchild;
+            break;
+        }
+    }
+
+    while (n_lefts > 0)
+        *left = joinNullable(pool, lefts[--n_lefts], *left);
+    while (n_rights > 0)
+        *right = joinNullable(pool, *right, rights[--n_rights]);
 }
 
-static char *strdup(const char *self) {
-    int len = strlen(self);
-    char *outp = malloc(len);
-    if (!outp) return NULL;
-    memcpy(outp, self, len + 1);
-    return outp;
+/* Inserts text inside the leaf that holds pos, or at the end of the leaf to
+ * its left when pos falls between two leaves.
+ *
+ * On success, zero is returned. If that leaf has no room for text, -1 is
+ * returned and self is left unchanged. */
+static int insertInPlace(RopePool *pool, RopeNode **self, int pos,
+                         const char *text, int len) {
+    /* The leaf is checked for room before anything on the way is copied. */
+    const RopeNode *leaf = *self;
+    for (int p = pos; !isLeaf(leaf); ) {
+        if (p <= leaf->value) {
+            leaf = leaf->lchild;
+        } else {
+            p -= leaf->value;
+            leaf = leaf->rchild;
+        }
+    }
+    if (leaf->value + len > ROPE_CHUNK_SIZE) return -1;
+
+    RopeNode *path[ROPE_MAX_DEPTH];
+    int depth = 0;
+    RopeNode *node = *self = ownNode(pool, *self);
+    while (!isLeaf(node)) {
+        path[depth++] = node;
+        if (pos <= node->value) {
+            node = node->lchild = ownNode(pool, node->lchild);
+        } else {
+            pos -= node->value;
+            node = node->rchild = ownNode(pool, node->rchild);
+        }
+    }
+
+    char *dest = node->text + pos;
+    memmove(dest + len, dest, node->value - pos);
+    memcpy(dest, text, len);
+    node->value = node->size = node->value + len;
+    node->lines += countNewlines(text, len);
+    node->chars += countChars(text, len);
+    node->power = 0;
+
+    while (depth > 0) updateNode(path[--depth]);
+    return 0;
+}
+
+/* Removes the range [begin, end) when it lies inside a single leaf, and that
+ * leaf stays above the merge threshold (unless it is the whole rope). The
+ * range must not cover the whole rope.
+ *
+ * On success, zero is returned. Otherwise, -1 is returned and self is left
+ * unchanged. */
+static int deleteInPlace(RopePool *pool, RopeNode **self, int begin, int end) {
+    RopeNode *path[ROPE_MAX_DEPTH];
+    int depth = 0;
+    RopeNode **link = self;
+    while (!isLeaf(*link)) {
+        RopeNode *node = *link;
+        int left = (end <= node->value);
+        if (!left && (begin < node->value)) return -1;
+        if (!left) {
+            begin -= node->value;
+            end -= node->value;
+        }
+
+        const RopeNode *child = left ? node->lchild : node->rchild;
+        if (isLeaf(child) &&
+                (child->value - (end - begin) < ROPE_MERGE_THRESHOLD))
+            return -1;
+
+        /* Children of a copy of node would be shared, so copy it only now
+         * that child is known to be edited. */
+        node = *link = ownNode(pool, node);
+        path[depth++] = node;
+        link = left ? &(node->lchild) : &(node->rchild);
+    }
+
+    RopeNode *node = *link = ownNode(pool, *link);
+    node->lines -= countNewlines(node->text + begin, end - begin);
+    node->chars -= countChars(node->text + begin, end - begin);
+    memmove(node->text + begin, node->text + end, node->value - end);
+    node->value = node->size = node->value - (end - begin);
+    node->power = 0;
+
+    while (depth > 0) updateNode(path[--depth]);
+    return 0;
+}
+
+/* Concatenates two ropes. If the last leaf of l_rope and the first leaf of
+ * r_rope are small enough, they are merged into one. */
+static RopeNode *joinMerging(RopePool *pool, RopeNode *l_rope,
+                             RopeNode *r_rope) {
+    if (!l_rope) return r_rope;
+    if (!r_rope) return l_rope;
+
+    const RopeNode *last = l_rope;
+    while (!isLeaf(last)) last = last->rchild;
+
+    const RopeNode *first = r_rope;
+    while (!isLeaf(first)) first = first->lchild;
+
+    int l_len = last->value;
+    int r_len = first->value;
+    if ((l_len + r_len <= ROPE_CHUNK_SIZE) &&
+            ((l_len < ROPE_MERGE_THRESHOLD) ||
+             (r_len < ROPE_MERGE_THRESHOLD))) {
+        l_rope = appendToLast(pool, l_rope, first->text, r_len);
+        r_rope = dropFirstLeaf(pool, r_rope);
+        if (!r_rope) return l_rope;
+    }
+
+    return joinBalanced(pool, l_rope, r_rope);
+}
+
+/* Copies text at the end of the last leaf of self, which must have room.
+ *
+ * Returns the new root, which differs from self if self was shared. */
+static RopeNode *appendToLast(RopePool *pool, RopeNode *self,
+                              const char *text, int len) {
+    RopeNode *path[ROPE_MAX_DEPTH];
+    int depth = 0;
+    RopeNode *node = self = ownNode(pool, self);
+    while (!isLeaf(node)) {
+        path[depth++] = node;
+        node = node->rchild = ownNode(pool, node->rchild);
+    }
+
+    memcpy(node->text + node->value, text, len);
+    node->value = node->size = node->value + len;
+    node->lines += countNewlines(text, len);
+    node->chars += countChars(text, len);
+    node->power = 0;
+
+    while (depth > 0) updateNode(path[--depth]);
+    return self;
+}
+
+/* Deletes the first leaf of self.
+ *
+ * Returns the new root, or NULL if self was a single leaf. */
+static RopeNode *dropFirstLeaf(RopePool *pool, RopeNode *self) {
+    RopeNode *path[ROPE_MAX_DEPTH];
+    int depth = 0;
+    while (!isLeaf(self)) {
+        self = ownNode(pool, self);
+        path[depth++] = self;
+        self = self->lchild;
+    }
+    deleteTree(pool, self);
+    if (depth == 0) return NULL;
+
+    /* The parent of the leaf gives way to its right child, and the nodes
+     * above are rebalanced on the way back up. */
+    RopeNode *parent = path[--depth];
+    RopeNode *root = parent->rchild;
+    deleteNode(pool, parent);
+    while (depth > 0) {
+        RopeNode *node = path[--depth];
+        node->lchild = root;
+        root = rebalance(pool, node);
+    }
+    return root;
+}
+
+/* Concatenates two non empty ropes, keeping the result balanced. */
+static RopeNode *joinBalanced(RopePool *pool, RopeNode *l_rope,
+                              RopeNode *r_rope) {
+    RopeNode *path[ROPE_MAX_DEPTH];
+    int depth = 0;
+    int l_height = getHeight(l_rope);
+    int r_height = getHeight(r_rope);
+
+    /* The taller rope is walked down along its inner spine to a subtree
+     * about as tall as the other rope, which is hung there. The nodes
+     * walked are rebalanced on the way back up. */
+    if (l_height > r_height + 1) {
+        while (getHeight(l_rope) > r_height + 1) {
+            l_rope = ownNode(pool, l_rope);
+            path[depth++] = l_rope;
+            l_rope = l_rope->rchild;
+        }
+        RopeNode *joined = newNode(pool, l_rope, r_rope);
+        while (depth > 0) {
+            RopeNode *node = path[--depth];
+            node->rchild = joined;
+            joined = rebalance(pool, node);
+        }
+        return joined;
+    }
+
+    if (r_height > l_height + 1) {
+        while (getHeight(r_rope) > l_height + 1) {
+            r_rope = ownNode(pool, r_rope);
+            path[depth++] = r_rope;
+            r_rope = r_rope->lchild;
+        }
+        RopeNode *joined = newNode(pool, l_rope, r_rope);
+        while (depth > 0) {
+            RopeNode *node = path[--depth];
+            node->lchild = joined;
+            joined = rebalance(pool, node);
+        }
+        return joined;
+    }
+
+    return newNode(pool, l_rope, r_rope);
+}
+
+static RopeNode *joinNullable(RopePool *pool, RopeNode *l_rope,
+                              RopeNode *r_rope) {
+    if (!l_rope) return r_rope;
+    if (!r_rope) return l_rope;
+    return joinBalanced(pool, l_rope, r_rope);
+}
+
+/* Restores the AVL invariant on self, given that both of its subtrees are
+ * balanced and their heights differ by at most two. self must not be
+ * shared. */
+static RopeNode *rebalance(RopePool *pool, RopeNode *self) {
+    int balance = getHeight(self->lchild) - getHeight(self->rchild);
+
+    if (balance > 1) {
+        RopeNode *lchild = self->lchild;
+        if (getHeight(lchild->lchild) < getHeight(lchild->rchild))
+            self->lchild = rotateLeft(pool, ownNode(pool, lchild));
+        return rotateRight(pool, self);
+    }
+
+    if (balance < -1) {
+        RopeNode *rchild = self->rchild;
+        if (getHeight(rchild->rchild) < getHeight(rchild->lchild))
+            self->rchild = rotateRight(pool, ownNode(pool, rchild));
+        return rotateLeft(pool, self);
+    }
+
+    updateNode(self);
+    return self;
+}
+
+/* Rotations move a child of self up, so both must not be shared; self is
+ * the caller's job, the child is copied here if needed. */
+static RopeNode *rotateLeft(RopePool *pool, RopeNode *self) {
+    RopeNode *pivot = ownNode(pool, self->rchild);
+    self->rchild = pivot->lchild;
+    pivot->lchild = self;
+
+    updateNode(self);
+    updateNode(pivot);
+    return pivot;
+}
+
+static RopeNode *rotateRight(RopePool *pool, RopeNode *self) {
+    RopeNode *pivot = ownNode(pool, self->lchild);
+    self->lchild = pivot->rchild;
+    pivot->rchild = self;
+
+    updateNode(self);
+    updateNode(pivot);
+    return pivot;
+}
+
+/* Recomputes the cached weight, size, newline and character counts, and
+ * height of an inner node from its children. Its hash is left stale. */
+static void updateNode(RopeNode *self) {
+    int l_height = getHeight(self->lchild);
+    int r_height = getHeight(self->rchild);
+
+    self->value = getSize(self->lchild);
+    self->size = self->value + getSize(self->rchild);
+    self->lines = getLines(self->lchild) + getLines(self->rchild);
+    self->chars = getChars(self->lchild) + getChars(self->rchild);
+    self->power = 0;
+    self->height = 1 + (l_height > r_height ? l_height : r_height);
+}
+
+static int getHeight(const RopeNode *self) {
+    return self ? self->height : -1;
+}
+
+static int getSize(const RopeNode *self) {
+    return self ? self->size : 0;
+}
+
+static int getLines(const RopeNode *self) {
+    return self ? self->lines : 0;
+}
+
+/* Counts the newlines in the first len bytes of text.
+ *
+ * Eight bytes are looked at per step: xoring a word with newlines zeroes the
+ * bytes that were newlines, and the top bit of exactly those bytes is then
+ * set by the zero byte test, which does not carry from byte to byte. */
+static int countNewlines(const char *text, int len) {
+    const uint64_t ones = UINT64_C(0x0101010101010101);
+    const uint64_t low7 = UINT64_C(0x7f7f7f7f7f7f7f7f);
+    int count = 0;
+    int i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, text + i, 8);
+        word ^= ones * '\n';
+
+        uint64_t zeroes = ~(((word & low7) + low7) | word | low7);
+        /* One bit per zero byte; the multiplication adds them up in the top
+         * byte. */
+        count += (int) (((zeroes >> 7) * ones) >> 56);
+    }
+
+    for (; i < len; i++)
+        if (text[i] == '\n') count++;
+    return count;
+}
+
+static int getChars(const RopeNode *self) {
+    return self ? self->chars : 0;
+}
+
+/* Counts the UTF-8 characters that start in the first len bytes of text,
+ * which are the bytes that are not continuation bytes.
+ *
+ * As in countNewlines, eight bytes are looked at per step. A continuation
+ * byte has its top bit set and the next one clear, so shifting the word by
+ * one bit lines up the second bit of each byte under the first. */
+static int countChars(const char *text, int len) {
+    const uint64_t ones = UINT64_C(0x0101010101010101);
+    const uint64_t high = UINT64_C(0x8080808080808080);
+    int continuations = 0;
+    int i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, text + i, 8);
+
+        uint64_t marks = word & ~(word << 1) & high;
+        continuations += (int) (((marks >> 7) * ones) >> 56);
+    }
+
+    for (; i < len; i++)
+        if (isContinuation(text[i])) continuations++;
+    return len - continuations;
+}
+
+static int isContinuation(char c) {
+    return ((unsigned char) c & 0xc0) == 0x80;
+}
+
+/* Computes the hash of self, if stale. An edit leaves stale the nodes it
+ * touched and all of their ancestors, so only stale nodes are descended
+ * into, and the cost is that of hashing the leaves edited since the last
+ * time. A node may be shared, but its text cannot change while it is, so
+ * the hash is valid for every rope sharing it. */
+static void hashNode(RopeNode *self) {
+    /* A node is hashed after its children, which are stacked above it. */
+    RopeNode *stack[ROPE_MAX_DEPTH + 1];
+    int top = 0;
+    stack[top++] = self;
+    while (top > 0) {
+        RopeNode *node = stack[top - 1];
+        if (node->power) {
+            top--;
+        } else if (isLeaf(node)) {
+            node->hash = hashText(node->text, node->value);
+            node->power = hashPower(node->value);
+            top--;
+        } else if (!node->lchild->power) {
+            stack[top++] = node->lchild;
+        } else if (!node->rchild->power) {
+            stack[top++] = node->rchild;
+        } else {
+            node->hash = reduceMod(mulMod(node->lchild->hash,
+                                          node->rchild->power) +
+                                   node->rchild->hash);
+            node->power = mulMod(node->lchild->power, node->rchild->power);
+            top--;
+        }
+    }
+}
+
+/* Returns the hash of the first pos bytes of the subtree of self. Subtrees
+ * that lie wholly before pos use their own hash, so only the leaf holding
+ * pos is hashed byte by byte, on the single path down to it. */
+static uint64_t prefixHash(RopeNode *self, int pos) {
+    uint64_t hash = 0;
+    while (pos > 0) {
+        if (pos == self->size) {
+            hashNode(self);
+            return reduceMod(mulMod(hash, self->power) + self->hash);
+        }
+        if (isLeaf(self))
+            return reduceMod(mulMod(hash, hashPower(pos)) +
+                             hashText(self->text, pos));
+
+        if (pos <= self->value) {
+            self = self->lchild;
+        } else {
+            RopeNode *lchild = self->lchild;
+            hashNode(lchild);
+            hash = reduceMod(mulMod(hash, lchild->power) + lchild->hash);
+            pos -= self->value;
+            self = self->rchild;
+        }
+    }
+    return hash;
+}
+
+static uint64_t hashText(const char *text, int len) {
+    uint64_t hash = 0;
+    for (int i = 0; i < len; i++)
+        hash = reduceMod(mulMod(hash, ROPE_HASH_BASE) +
+                         (unsigned char) text[i] + 1);
+    return hash;
+}
+
+/* Returns the base raised to len, by repeated squaring. */
+static uint64_t hashPower(int len) {
+    uint64_t power = 1, square = ROPE_HASH_BASE;
+    for (; len > 0; len >>= 1) {
+        if (len & 1) power = mulMod(power, square);
+        square = mulMod(square, square);
+    }
+    return power;
+}
+
+/* Returns a * b modulo the hash prime, for a and b below it.
+ *
+ * C99 has no wider integer to hold the product, so it is put together from
+ * 32 bit halves. As 2^61 is 1 modulo the prime, whatever lies past bit 61
+ * is folded back onto the low bits. */
+static uint64_t mulMod(uint64_t a, uint64_t b) {
+    uint64_t a_hi = a >> 32, a_lo = a & 0xffffffff;
+    uint64_t b_hi = b >> 32, b_lo = b & 0xffffffff;
+
+    /* a_hi * b_hi is worth 2^64 times its value, which is 2^3 modulo the
+     * prime, and the middle terms are worth 2^32 times theirs. */
+    uint64_t mid = a_hi * b_lo + a_lo * b_hi;
+    uint64_t lo = a_lo * b_lo;
+    uint64_t sum = ((a_hi * b_hi) << 3) + (mid >> 29) +
+        ((mid & ((UINT64_C(1) << 29) - 1)) << 32) +
+        (lo & ROPE_HASH_PRIME) + (lo >> 61);
+    return reduceMod(sum);
+}
+
+/* Returns x modulo the hash prime, for x below 2^63. */
+static uint64_t reduceMod(uint64_t x) {
+    x = (x & ROPE_HASH_PRIME) + (x >> 61);
+    return (x >= ROPE_HASH_PRIME) ? x - ROPE_HASH_PRIME : x;
+}
+
+/* Returns the offset where line starts in the subtree of self, which must
+ * have at least line newlines. */
+static int lineStart(const RopeNode *self, int line) {
+    if (line == 0) return 0;
+
+    int offset = 0;
+    while (!isLeaf(self)) {
+        if (line <= self->lchild->lines) {
+            self = self->lchild;
+        } else {
+            line -= self->lchild->lines;
+            offset += self->value;
+            self = self->rchild;
+        }
+    }
+
+    const char *p = self->text;
+    while (line-- > 0)
+        p = (const char *) memchr(p, '\n', self->text + self->value - p) + 1;
+    return offset + (p - self->text);
+}
+
+/* Tells whether pattern starts at text, the last len bytes of a leaf. When
+ * the pattern is longer, the comparison goes on with the leaves that it
+ * returns next, through a copy of it so the caller's iterator stays put. */
+static int matchesAt(const RopeIter *it, const char *text, int len,
+                     const char *pattern, int pattern_len) {
+    if (pattern_len <= len) return memcmp(text, pattern, pattern_len) == 0;
+    if (memcmp(text, pattern, len)) return 0;
+
+    RopeIter next = *it;
+    pattern += len;
+    pattern_len -= len;
+    while (Rope_iterNext(&next, &text, &len)) {
+        int n = (len < pattern_len) ? len : pattern_len;
+        if (memcmp(text, pattern, n)) return 0;
+
+        pattern += n;
+        pattern_len -= n;
+        if (pattern_len == 0) return 1;
+    }
+    return 0;
+}
+
+/* Places it so that the next leaf it returns is the one holding offset pos
+ * of self, and returns the offset of pos inside that leaf. pos may be the
+ * size of self, which is held by the end of the last leaf. */
+static int iterSeek(RopeIter *it, const RopeNode *self, int pos) {
+    it->top = 0;
+    it->flat = NULL;
+    if (!self) return 0;
+
+    /* Only nodes whose right side is still to come are pushed. */
+    while (!isLeaf(self)) {
+        if (pos < self->value) {
+            it->stack[it->top++] = self;
+            self = self->lchild;
+        } else {
+            pos -= self->value;
+            self = self->rchild;
+        }
+    }
+    it->stack[it->top++] = self;
+    return pos;
+}
+
+/* Places it before the first leaf of self, even if the rope is frozen. */
+static void iterLeaves(RopeIter *it, const RopeNode *self) {
+    it->top = 0;
+    it->flat = NULL;
+    pushLeftSpine(it, self);
+}
+
+static void pushLeftSpine(RopeIter *it, const RopeNode *self) {
+    for (; self; self = self->lchild) it->stack[it->top++] = self;
+}
+
+/* Copies the range [begin, end) of the subtree of self into dest, leaf by
+ * leaf, starting inside the one that holds begin. */
+static void copyRange(const RopeNode *self, int begin, int end, char *dest) {
+    RopeIter it;
+    const char *text;
+    int len;
+    int skip = iterSeek(&it, self, begin);
+    while ((begin < end) && Rope_iterNext(&it, &text, &len)) {
+        int n = len - skip;
+        if (n > end - begin) n = end - begin;
+        memcpy(dest, text + skip, n);
+        dest += n;
+        begin += n;
+        skip = 0;
+    }
+}
+
+/* Copies the text under self into s using one thread per core.
+ *
+ * The weight of each node is the offset where its right subtree starts, so
+ * the tree is cut in subtrees whose place in s is known beforehand, and the
+ * threads copy them without talking to each other. The calling thread does
+ * a share of the work too, and also the share of any thread that could not
+ * be started, so this never fails. */
+static void flattenParallel(const RopeNode *self, char *s) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = (cores < 1) ? 1 : (cores > ROPE_MAX_THREADS) ?
+        ROPE_MAX_THREADS : (int) cores;
+
+    FlattenJob jobs[ROPE_MAX_THREADS * ROPE_JOBS_PER_THREAD];
+    jobs[0] = (FlattenJob) { .subtree = self, .dest = s };
+    int n = splitJobs(jobs, 1, threads * ROPE_JOBS_PER_THREAD);
+    if (threads > n) threads = n;
+
+    /* Thread i takes the i-th run of consecutive jobs. */
+    FlattenWork work[ROPE_MAX_THREADS];
+    pthread_t ids[ROPE_MAX_THREADS];
+    int started[ROPE_MAX_THREADS];
+    for (int i = 0; i < threads; i++) {
+        int first = i * n / threads;
+        work[i] = (FlattenWork) {
+            .jobs = jobs + first, .len = (i + 1) * n / threads - first
+        };
+    }
+
+    for (int i = 1; i < threads; i++)
+        started[i] = (pthread_create(&ids[i], NULL, flattenWork,
+                                     &work[i]) == 0);
+    flattenWork(&work[0]);
+
+    for (int i = 1; i < threads; i++) {
+        if (started[i])
+            pthread_join(ids[i], NULL);
+        else
+            flattenWork(&work[i]);
+    }
+}
+
+/* Replaces each of the n jobs on an inner node by one per child, a level of
+ * the tree at a time, while the result fits in max jobs. Jobs stay in the
+ * order of the text.
+ *
+ * Returns the new number of jobs. */
+static int splitJobs(FlattenJob *jobs, int n, int max) {
+    for (;;) {
+        int inner = 0;
+        for (int i = 0; i < n; i++)
+            if (!isLeaf(jobs[i].subtree)) inner++;
+        if ((inner == 0) || (n + inner > max)) return n;
+
+        /* Fill from the back, so no job is overwritten before it is read. */
+        int last = n + inner;
+        for (int i = n - 1; i >= 0; i--) {
+            const RopeNode *node = jobs[i].subtree;
+            char *dest = jobs[i].dest;
+            if (isLeaf(node)) {
+                jobs[--last] = jobs[i];
+                continue;
+            }
+            jobs[--last] = (FlattenJob) {
+                .subtree = node->rchild, .dest = dest + node->value
+            };
+            jobs[--last] = (FlattenJob) {
+                .subtree = node->lchild, .dest = dest
+            };
+        }
+        n += inner;
+    }
+}
+
+/* Thread entry point, taking a FlattenWork. */
+static void *flattenWork(void *work) {
+    const FlattenWork *self = work;
+    for (int i = 0; i < self->len; i++)
+        flattenSubtree(self->jobs[i].subtree, self->jobs[i].dest);
+    return NULL;
+}
+
+static void flattenSubtree(const RopeNode *self, char *dest) {
+    RopeIter it;
+    const char *text;
+    int len;
+
+    iterLeaves(&it, self);
+    while (Rope_iterNext(&it, &text, &len)) {
+        memcpy(dest, text, len);
+        dest += len;
+    }
+}
+
+/* Moves the cursor down to the deepest node whose subtree holds the range
+ * [begin, end], which must not be empty. When the path is still valid, the
+ * descent starts from the lowest node on it that holds the range. Nodes are
+ * copied on the way down if shared, so the whole path can be edited.
+ *
+ * Returns the node the cursor ends on: a leaf, unless the range spans more
+ * than one. */
+static RopeNode *seek(RopeCursor *self, int begin, int end) {
+    Rope *rope = self->rope;
+    int i = self->depth - 1;
+    if ((self->stamp != rope->stamp) || (i < 0)) {
+        rope->root = ownNode(rope->pool, rope->root);
+        self->path[0] = rope->root;
+        self->start[0] = 0;
+        self->stamp = rope->stamp;
+        i = 0;
+    }
+
+    while ((i > 0) && ((begin < self->start[i]) ||
+                       (end > self->start[i] + self->path[i]->size)))
+        i--;
+
+    RopeNode *node = self->path[i];
+    int start = self->start[i];
+    while (!isLeaf(node)) {
+        RopeNode **child;
+        if (end <= start + node->value) {
+            child = &(node->lchild);
+        } else if (begin >= start + node->value) {
+            start += node->value;
+            child = &(node->rchild);
+        } else {
+            break;
+        }
+        node = *child = ownNode(rope->pool, *child);
+        self->path[++i] = node;
+        self->start[i] = start;
+    }
+
+    self->depth = i + 1;
+    return node;
+}
+
+/* Accounts for the leaf the cursor is on gaining text, delta bytes long, or
+ * losing it when delta is negative; in that case text must still be in the
+ * leaf. The length and counts of the leaf are adjusted, along with the
+ * cached sizes and counts of its ancestors. No height changes, so the path
+ * stays valid. */
+static void addAlongPath(RopeCursor *self, const char *text, int delta) {
+    int sign = (delta < 0) ? -1 : 1;
+    int lines = sign * countNewlines(text, sign * delta);
+    int chars = sign * countChars(text, sign * delta);
+
+    RopeNode *leaf = self->path[self->depth - 1];
+    leaf->value += delta;
+    leaf->size += delta;
+    leaf->lines += lines;
+    leaf->chars += chars;
+    leaf->power = 0;
+
+    for (int i = self->depth - 2; i >= 0; i--) {
+        RopeNode *node = self->path[i];
+        node->size += delta;
+        node->lines += lines;
+        node->chars += chars;
+        node->power = 0;
+        if (node->lchild == self->path[i + 1]) node->value += delta;
+    }
+
+    markEdited(self->rope);
+    self->stamp = self->rope->stamp;
 }
@@ -1,11 +1,38 @@
-/* Heap based implementation of the rope structure. */
+/* Heap based implementation of the rope structure.
+ *
+ * Every rope owns a pool its nodes are allocated from. Ropes obtained by
+ * splitting share the pool of the original one, and joining ropes from
+ * different pools moves the nodes of the right one into the left pool. */
 
 #ifndef ROPE_H
 #define ROPE_H
 
-#include "bintree.h"
+#include <stdint.h>
+
+typedef struct Rope Rope;
+
+/* Deep enough for any balanced rope that fits in memory. */
+#define ROPE_MAX_DEPTH 64
+
+typedef struct RopeCursor RopeCursor;
 
-typedef BinaryTree Rope;
+/* An edit for Rope_applyBatch: the range [begin, end) is replaced by the
+ * null-terminated text. An insertion has begin equal to end, and a deletion
+ * has an empty text. */
+typedef struct {
+    int begin;
+    int end;
+    const char *text;
+} RopeEdit;
+
+/* Walks over the text of a rope, one leaf at a time, without copying it.
+ * When the rope is frozen, its whole text is a single run, held in flat. */
+typedef struct {
+    const struct RopeNode *stack[ROPE_MAX_DEPTH];
+    int top;
+    const char *flat;
+    int flat_len;
+} RopeIter;
 
 /* Creates a new empty Rope.
  *
@@ -24,8 +51,33 @@ Rope *Rope_new();
  * dependent. */
 Rope *Rope_newFrom(const char *text);
 
+/* Creates a new Rope holding the first len bytes of buf, which need not be
+ * null-terminated.
+ *
+ * buf is cut in full chunks, and a balanced tree is built over them in a
+ * single pass, in time linear in len. buf is not referenced afterwards, so it
+ * can be a mapping that is unmapped right away.
+ *
+ * On success, a pointer to the newly created Rope is returned. On error,
+ * NULL is returned. */
+Rope *Rope_buildFrom(const char *buf, int len);
+
+/* Releases self. When no other rope shares its pool, the whole document is
+ * released slab by slab, without walking the tree. */
 void Rope_destroy(Rope *self);
 
+/* Gives back to the pool of self up to budget nodes of the text deleted from
+ * ropes sharing that pool.
+ *
+ * Deleting a range only queues the subtree holding it, so that it takes
+ * O(log n) whatever the size of the range. Every later allocation gives back
+ * a couple of queued nodes; this lets the caller give back the rest in
+ * slices of its choosing, when it has nothing else to do.
+ *
+ * Returns the number of nodes given back, which is less than budget once
+ * nothing is left to reclaim. */
+int Rope_reclaim(Rope *self, int budget);
+
 Rope *Rope_insert(Rope *self, int pos, const char *text);
 
 Rope *Rope_delete(Rope *self, int begin, int end);
@@ -44,13 +96,117 @@ Rope *Rope_delete(Rope *self, int begin, int end);
  *
  * A negative position will be considered an offset relative to the end of
  * the rope. So position -1 is the last character of the rope. */
-Rope *Rope_split(Rope *self, int p); /* Stub. Always returns NULL. */
+Rope *Rope_split(Rope *self, int p);
 
-/* Concatenates l_rope and r_rope. */
+/* Concatenates l_rope and r_rope.
+ *
+ * The result is l_rope, with the contents of r_rope appended. r_rope is
+ * consumed. */
 Rope *Rope_join(Rope *l_rope, Rope *r_rope);
 
+/* Applies the n edits to self, one after the other: the positions of each
+ * edit refer to the text left by the edits before it, and negative ones
+ * count from its end, as in Rope_insert and Rope_delete. Edits that are out
+ * of range are skipped.
+ *
+ * The edits are first combined into changes to the text as it is now, kept
+ * sorted and apart from each other; edits that touch are merged. Then all of
+ * them are made in a single pass from left to right, so each part of the
+ * tree is taken apart and joined back only once. Combining costs O(n) per
+ * edit, so this is meant for bursts of edits, not for thousands at once.
+ *
+ * On success, the number of edits applied is returned. On error, -1 is
+ * returned and self is left unchanged. */
+int Rope_applyBatch(Rope *self, const RopeEdit *edits, int n);
+
+/* Replaces every occurrence of the null-terminated pattern in self with
+ * replacement, scanning from the start. Occurrences do not overlap.
+ *
+ * The new tree is built in a single pass over the leaves of self. Leaves
+ * without a match are shared with the old tree rather than copied.
+ *
+ * On success, the number of replacements is returned. On error, -1 is
+ * returned and self is left unchanged. */
+int Rope_replaceAll(Rope *self, const char *pattern, const char *replacement);
+
+/* Returns a new rope with the same contents as self, in constant time.
+ *
+ * Both ropes share their nodes until they are edited, and an edit on either
+ * copies only the nodes on the path it touches. The snapshot shares the pool
+ * of self, and must be destroyed with Rope_destroy.
+ *
+ * On success, a pointer to the new rope is returned. On error, NULL is
+ * returned. */
+Rope *Rope_snapshot(Rope *self);
+
+/* Lays the text of self out flat, for the reads that follow until its next
+ * edit, which drops it.
+ *
+ * The text goes in a single block, along with the offset of every line
+ * start, both in order and in Eytzinger order (the children of entry k are
+ * entries 2k and 2k + 1), so that a lookup walks down a few cache lines
+ * without branching on the data. Meanwhile, the text of self is read from
+ * that block: Rope_toString and Rope_substring are a copy, Rope_lineOffset
+ * a lookup, Rope_lineAt a search of the Eytzinger array, and iterators and
+ * Rope_find go over the text as a single run. Other reads keep using the
+ * tree. Freezing a rope that is already frozen does nothing.
+ *
+ * On success, zero is returned. On error, -1 is returned, and self is read
+ * from the tree as before. */
+int Rope_freeze(Rope *self);
+
+/* Returns the length of the string held by self, in constant time. */
 int Rope_size(const Rope *self);
 
+/* Returns the number of lines in self, which is one more than the number of
+ * newlines it holds. */
+int Rope_lines(const Rope *self);
+
+/* Returns the offset of the given column of the given line, both counted from
+ * zero, in O(log n).
+ *
+ * A column may go up to the length of the line, which addresses the newline
+ * ending it (or the end of the rope, on the last line). If there is no such
+ * line or column, -1 is returned. */
+int Rope_lineOffset(const Rope *self, int line, int column);
+
+/* Returns the line that holds offset pos, counted from zero, in O(log n).
+ *
+ * If pos is out of range, -1 is returned. */
+int Rope_lineAt(const Rope *self, int pos);
+
+/* Returns the number of UTF-8 characters in self, in constant time. Bytes
+ * that are not continuation bytes each start a character. */
+int Rope_chars(const Rope *self);
+
+/* Returns the offset of the character with the given index, counted from
+ * zero, in O(log n). The index may be the number of characters in self,
+ * which addresses the end of the rope.
+ *
+ * If index is out of range, -1 is returned. */
+int Rope_charOffset(const Rope *self, int index);
+
+/* Returns the number of characters that start before offset pos, which is
+ * the index of the character at pos, in O(log n).
+ *
+ * If pos is out of range, -1 is returned. */
+int Rope_charIndex(const Rope *self, int pos);
+
+/* Sets hash to a hash of the text in the range [begin, end) of self.
+ *
+ * Every node keeps the hash of its subtree, so this takes O(log n), and the
+ * whole rope is hashed in constant time. Edits do not pay for hashing: the
+ * nodes they touch are rehashed here, the next time they are needed, which
+ * is why self is not const.
+ *
+ * Equal texts hash the same however their ropes are built or edited, so
+ * comparing hashes tells, with high probability, whether two texts are
+ * equal. The hash is keyed by nothing, so it guards against accidents, not
+ * against someone crafting collisions.
+ *
+ * On success, zero is returned. If the range is not valid, -1 is returned. */
+int Rope_hash(Rope *self, int begin, int end, uint64_t *hash);
+
 /* Returns the contents of the Rope as a null-terminated string.
  *
  * This function returns a pointer to a new string which holds the full
@@ -58,4 +214,56 @@ int Rope_size(const Rope *self);
  * and can be freed with free. */
 char *Rope_toString(const Rope *self);
 
+/* Same as Rope_toString, for the range [begin, end) of self.
+ *
+ * If the range is not valid, NULL is returned. */
+char *Rope_substring(const Rope *self, int begin, int end);
+
+/* Returns the offset of the first occurrence of the null-terminated pattern
+ * in self that starts at from or after it. Occurrences may span any number
+ * of leaves.
+ *
+ * If there is none, or pattern is empty, or from is out of range, -1 is
+ * returned. */
+int Rope_find(const Rope *self, const char *pattern, int from);
+
+/* Places it before the first leaf of self. */
+void Rope_iterBegin(const Rope *self, RopeIter *it);
+
+/* Places it before the leaf of self that holds offset pos, in O(log n), so
+ * that a range can be read without visiting the leaves before it. pos may be
+ * the size of self, which the last leaf ends at. A frozen rope is a single
+ * leaf.
+ *
+ * On success, the offset of pos inside that leaf is returned. If pos is out
+ * of range, -1 is returned. */
+int Rope_iterSeek(const Rope *self, RopeIter *it, int pos);
+
+/* Moves it to the next leaf.
+ *
+ * If there is one, 1 is returned and text and len are set to the contents of
+ * the leaf, which are not null-terminated and remain valid until the rope is
+ * modified. At the end of the rope, 0 is returned. */
+int Rope_iterNext(RopeIter *it, const char **text, int *len);
+
+/* Creates a cursor over rope.
+ *
+ * A cursor remembers the path from the root to the last leaf it edited. An
+ * edit that fits in that leaf is done without descending from the root, and
+ * an edit close to it only descends from their lowest common ancestor.
+ * Edits made without the cursor are allowed, they just make it start over
+ * from the root. The cursor must be destroyed before rope.
+ *
+ * On success, a pointer to the new cursor is returned. On error, NULL is
+ * returned. */
+RopeCursor *RopeCursor_new(Rope *rope);
+
+void RopeCursor_destroy(RopeCursor *self);
+
+/* Same as Rope_insert and Rope_delete, on the rope of the cursor.
+ *
+ * On success, zero is returned. On error, -1 is returned. */
+int RopeCursor_insert(RopeCursor *self, int pos, const char *text);
+int RopeCursor_delete(RopeCursor *self, int begin, int end);
+
 #endif
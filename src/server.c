@@ -1,27 +1,107 @@
 #define _POSIX_C_SOURCE 201709L
+#define _DEFAULT_SOURCE //realpath
 
 #include "server.h"
 #include "help.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <netdb.h>
 #include "socket.h"
 
 #include "rope.h"
+#include "delta.h"
 #include "courier.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <inttypes.h>
 #include <arpa/inet.h>
 
-static void serverLoop(Courier *courier);
+/* How many checkpoints UNDO can go back to. Older ones are forgotten. */
+#define SERVER_HISTORY 64
+
+/* Most edits applied together, when they arrive faster than they are
+ * applied. */
+#define SERVER_BATCH 256
+
+/* Most nodes of deleted text given back at a time, between checks for a new
+ * command. */
+#define SERVER_RECLAIM 4096
+
+/* How many times the size of the text lookups against the same version
+ * must have read before it is laid out flat for the ones that follow. The
+ * copy then costs less than the lookups already did, however small each of
+ * them is. */
+#define SERVER_FREEZE_RATIO 2
+
+/* Earlier or later versions of the document. They are rope snapshots, so
+ * keeping one costs nothing until the document is edited. */
+struct history_s {
+    Rope *versions[SERVER_HISTORY];
+    int len;
+};
+
+/* A range of a rope being sent leaf by leaf. skip is how much of the next
+ * leaf lies before the range, and left how much of the range is still to be
+ * sent. */
+struct range_s {
+    RopeIter it;
+    int skip;
+    int left;
+};
+
+/* The whole text of a rope, sent leaf by leaf after the mark of a script
+ * that holds it. */
+struct whole_s {
+    RopeIter it;
+    int marked;
+};
+
+static void serverLoop(Courier *courier, const char *root);
+static int nextLeaf(void *it, const char **data, int *len);
+static int nextInRange(void *range, const char **data, int *len);
+static int nextWhole(void *whole, const char **data, int *len);
+static void pushVersion(struct history_s *self, Rope *version);
+static void clearVersions(struct history_s *self);
+static int isEdit(int opcode);
+static int isBatchable(int opcode);
+static struct command_s applyEdits(Courier *courier, Rope *rope,
+                                   Delta *delta, struct command_s command);
+static RopeEdit toEdit(struct command_s command);
+static void addLookup(Rope *rope, long long *looked_up, int len);
+static int sendLines(Courier *courier, const Rope *rope, int from, int to);
+static int sendSlice(Courier *courier, const Rope *rope, int addressing,
+                      int from, int to);
+static int sendRange(Courier *courier, const Rope *rope, int begin, int end);
+static void sendLineCount(Courier *courier, const Rope *rope);
+static void sendDelta(Courier *courier, const Rope *rope, Delta *delta);
+static void load(Courier *courier, const char *root, const char *path,
+                  Rope **rope);
+static Rope *loadFile(const char *root, const char *path);
+static int isRelativeInside(const char *path);
+static int sendMatches(Courier *courier, const Rope *rope, int addressing,
+                       int mode, const char *pattern);
+static void sendHash(Courier *courier, Rope *rope, int addressing,
+                     int from, int to);
+static int toOffset(const Rope *rope, int addressing, int *pos);
+static int fromOffset(const Rope *rope, int addressing, int offset);
+static int lineOffset(const Rope *rope, int addressing, int line, int column);
 
 void serverRoutine(int argc, char **argv) {
-    if (argc > 3) { printHelp(); return; }
+    if (argc > 4) { printHelp(); return; }
+
+    /* LOAD only reads files under root, the current directory unless given. */
+    char *root = realpath((argc > 3) ? argv[3] : ".", NULL);
+    if (!root) { perror("Could not resolve root"); return; }
 
     socket_t sock;
-    if (socket_create(&sock)) return;
+    if (socket_create(&sock)) goto freeRoot;
 
     short portNumber;
     sscanf(argv[2] ? argv[2] : "8080", "%hd", &portNumber);
@@ -33,7 +113,7 @@ void serverRoutine(int argc, char **argv) {
 
         Courier *courier = Courier_new(&incoming);
 
-        serverLoop(courier);
+        serverLoop(courier, root);
 
         Courier_destroy(courier);
         socket_destroy(&incoming);
@@ -41,35 +121,163 @@ void serverRoutine(int argc, char **argv) {
 
 outro:
     socket_destroy(&sock);
+freeRoot:
+    free(root);
 }
 
-static void serverLoop(Courier *courier) {
+static void serverLoop(Courier *courier, const char *root) {
+    /* What changed since the client last received the text, which at first
+     * is empty. */
+    Delta *delta = Delta_new(0);
+    if (!delta) return;
+
     Rope *rope = Rope_new();
+    RopeCursor *cursor = RopeCursor_new(rope);
+    struct history_s undo = { .len = 0 };
+    struct history_s redo = { .len = 0 };
+    int addressing = COURIER_ADDRESS_BYTES;
+    /* Bytes of text read by lookups since the rope last changed. */
+    long long looked_up = 0;
 
+    struct command_s command = Courier_recvCommand(courier);
     do {
-        struct command_s command = Courier_recvCommand(courier);
+        /* A new edit makes the undone versions unreachable. */
+        if (isEdit(command.opcode)) clearVersions(&redo);
+
+        if (isEdit(command.opcode) || (command.opcode == COURIER_UNDO) ||
+                (command.opcode == COURIER_REDO))
+            looked_up = 0;
+
+        /* Edits that already wait behind this one go in together. */
+        if ((addressing == COURIER_ADDRESS_BYTES) &&
+                isBatchable(command.opcode) && Courier_hasCommand(courier)) {
+            command = applyEdits(courier, rope, delta, command);
+            continue;
+        }
 
         switch (command.opcode) {
             case COURIER_INSERT:
-                rope = Rope_insert(rope, command.u.i.pos, command.u.i.data);
+                if ((toOffset(rope, addressing, &(command.u.i.pos)) == 0) &&
+                    (RopeCursor_insert(cursor, command.u.i.pos,
+                                       command.u.i.data) == 0))
+                    Delta_edit(delta, command.u.i.pos, command.u.i.pos,
+                               strlen(command.u.i.data));
                 break;
             case COURIER_DELETE:
-                rope = Rope_delete(rope, command.u.d.from, command.u.d.to);
+                if ((toOffset(rope, addressing, &(command.u.d.from)) == 0) &&
+                    (toOffset(rope, addressing, &(command.u.d.to)) == 0) &&
+                    (RopeCursor_delete(cursor, command.u.d.from,
+                                       command.u.d.to) == 0))
+                    Delta_edit(delta, command.u.d.from, command.u.d.to, 0);
                 break;
             case COURIER_SPACE:
-                rope = Rope_insert(rope, command.u.s.pos, " ");
+                if ((toOffset(rope, addressing, &(command.u.s.pos)) == 0) &&
+                    (RopeCursor_insert(cursor, command.u.s.pos, " ") == 0))
+                    Delta_edit(delta, command.u.s.pos, command.u.s.pos, 1);
                 break;
             case COURIER_NEWLINE:
-                rope = Rope_insert(rope, command.u.n.pos, "\n");
+                if ((toOffset(rope, addressing, &(command.u.n.pos)) == 0) &&
+                    (RopeCursor_insert(cursor, command.u.n.pos, "\n") == 0))
+                    Delta_edit(delta, command.u.n.pos, command.u.n.pos, 1);
+                break;
+            case COURIER_LINE_INSERT:
+                {
+                    int pos = lineOffset(rope, addressing, command.u.li.line,
+                                         command.u.li.column);
+                    if ((pos >= 0) &&
+                        (RopeCursor_insert(cursor, pos,
+                                           command.u.li.data) == 0))
+                        Delta_edit(delta, pos, pos, strlen(command.u.li.data));
+                }
+                break;
+            case COURIER_LINE_DELETE:
+                {
+                    int from = lineOffset(rope, addressing,
+                                          command.u.ld.from_line,
+                                          command.u.ld.from_column);
+                    int to = lineOffset(rope, addressing,
+                                        command.u.ld.to_line,
+                                        command.u.ld.to_column);
+                    if ((from >= 0) && (to >= 0) &&
+                        (RopeCursor_delete(cursor, from, to) == 0))
+                        Delta_edit(delta, from, to, 0);
+                }
+                break;
+            case COURIER_ADDRESSING:
+                addressing = command.u.a.mode;
+                break;
+            case COURIER_LINE_PRINT:
+                addLookup(rope, &looked_up,
+                          sendLines(courier, rope, command.u.lp.from,
+                                    command.u.lp.to));
+                break;
+            case COURIER_LINES:
+                sendLineCount(courier, rope);
+                break;
+            case COURIER_PRINT_RANGE:
+                addLookup(rope, &looked_up,
+                          sendSlice(courier, rope, addressing,
+                                    command.u.pr.from, command.u.pr.to));
+                break;
+            case COURIER_HASH:
+                sendHash(courier, rope, addressing, command.u.h.from,
+                         command.u.h.to);
+                break;
+            case COURIER_LOAD:
+                {
+                    Rope *loaded = rope;
+                    load(courier, root, command.u.l.path, &loaded);
+                    if (loaded == rope) break;
+
+                    RopeCursor_destroy(cursor);
+                    Rope_destroy(rope);
+                    rope = loaded;
+                    cursor = RopeCursor_new(rope);
+                    Delta_invalidate(delta);
+                }
+                break;
+            case COURIER_SEARCH:
+                addLookup(rope, &looked_up,
+                          sendMatches(courier, rope, addressing,
+                                      command.u.f.mode, command.u.f.data));
+                break;
+            case COURIER_REPLACE:
+                if (Rope_replaceAll(rope, command.u.r.from,
+                                    command.u.r.to) != 0)
+                    Delta_invalidate(delta);
+                break;
+            case COURIER_CHECKPOINT:
+                clearVersions(&redo);
+                pushVersion(&undo, Rope_snapshot(rope));
+                break;
+            case COURIER_UNDO:
+            case COURIER_REDO:
+                {
+                    struct history_s *from = &undo, *to = &redo;
+                    if (command.opcode == COURIER_REDO) {
+                        from = &redo;
+                        to = &undo;
+                    }
+                    if (!from->len) break;
+
+                    RopeCursor_destroy(cursor);
+                    pushVersion(to, rope);
+                    rope = from->versions[--from->len];
+                    cursor = RopeCursor_new(rope);
+                    Delta_invalidate(delta);
+                }
                 break;
             case COURIER_PRINT:
                 {
-                    char *s = Rope_toString(rope);
-                    struct response_s r = { .len=strlen(s), .data=s };
-                    Courier_sendResponse(courier, r);
-                    Courier_destroyResponse(r);
+                    RopeIter it;
+                    Rope_iterBegin(rope, &it);
+                    Courier_sendResponseFrom(courier, Rope_size(rope),
+                                             nextLeaf, &it);
                 }
                 break;
+            case COURIER_DELTA_PRINT:
+                sendDelta(courier, rope, delta);
+                break;
             default:
                 Courier_destroyCommand(command);
                 /* I can't use break because that would only get me out of the
@@ -77,8 +285,431 @@ static void serverLoop(Courier *courier) {
                 goto outro;
         }
         Courier_destroyCommand(command);
+
+        /* Deleted text is given back while the client sends nothing. */
+        while ((Rope_reclaim(rope, SERVER_RECLAIM) == SERVER_RECLAIM) &&
+               !Courier_hasCommand(courier));
+
+        command = Courier_recvCommand(courier);
     } while (1);
 
 outro:
+    RopeCursor_destroy(cursor);
     Rope_destroy(rope);
+    clearVersions(&undo);
+    clearVersions(&redo);
+    Delta_destroy(delta);
+}
+
+static int nextLeaf(void *it, const char **data, int *len) {
+    return Rope_iterNext((RopeIter *) it, data, len);
+}
+
+/* Same as nextLeaf, trimming the leaves at either end of a range_s. */
+static int nextInRange(void *range, const char **data, int *len) {
+    struct range_s *self = range;
+    if (self->left == 0) return 0;
+    if (!Rope_iterNext(&(self->it), data, len)) return 0;
+
+    *data += self->skip;
+    *len -= self->skip;
+    self->skip = 0;
+    if (*len > self->left) *len = self->left;
+    self->left -= *len;
+    return 1;
+}
+
+/* Same as nextLeaf, after a first piece with the mark of a whole_s. */
+static int nextWhole(void *whole, const char **data, int *len) {
+    struct whole_s *self = whole;
+    if (self->marked) return Rope_iterNext(&(self->it), data, len);
+
+    self->marked = 1;
+    *data = "*";
+    *len = 1;
+    return 1;
+}
+
+/* Pushes version onto self, forgetting the oldest one if self is full. */
+static void pushVersion(struct history_s *self, Rope *version) {
+    if (!version) return;
+
+    if (self->len == SERVER_HISTORY) {
+        Rope_destroy(self->versions[0]);
+        memmove(self->versions, self->versions + 1,
+                (SERVER_HISTORY - 1) * sizeof(Rope *));
+        self->len--;
+    }
+    self->versions[self->len++] = version;
+}
+
+static void clearVersions(struct history_s *self) {
+    while (self->len) Rope_destroy(self->versions[--self->len]);
+}
+
+static int isEdit(int opcode) {
+    switch (opcode) {
+        case COURIER_INSERT:
+        case COURIER_DELETE:
+        case COURIER_SPACE:
+        case COURIER_NEWLINE:
+        case COURIER_LINE_INSERT:
+        case COURIER_LINE_DELETE:
+        case COURIER_LOAD:
+        case COURIER_REPLACE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* Edits that only need byte offsets, which can be known before the edits
+ * ahead of them are made. */
+static int isBatchable(int opcode) {
+    switch (opcode) {
+        case COURIER_INSERT:
+        case COURIER_DELETE:
+        case COURIER_SPACE:
+        case COURIER_NEWLINE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* Applies command, a batchable edit, together with the batchable edits that
+ * have already arrived after it, with a single Rope_applyBatch, and records
+ * them in delta. If the batch fails, they are applied one at a time.
+ *
+ * Returns the next command received, which is not part of the batch. */
+static struct command_s applyEdits(Courier *courier, Rope *rope,
+                                   Delta *delta, struct command_s command) {
+    struct command_s batch[SERVER_BATCH];
+    RopeEdit edits[SERVER_BATCH];
+    int n = 0;
+
+    do {
+        batch[n] = command;
+        edits[n++] = toEdit(command);
+        command = Courier_recvCommand(courier);
+    } while (isBatchable(command.opcode) && (n < SERVER_BATCH) &&
+             Courier_hasCommand(courier));
+
+    if (Rope_applyBatch(rope, edits, n) >= 0) {
+        /* Edits out of range are skipped by both alike. */
+        for (int i = 0; i < n; i++)
+            Delta_edit(delta, edits[i].begin, edits[i].end,
+                       strlen(edits[i].text));
+    } else {
+        /* The batch left the rope as it was: the edits are made one by one
+         * instead, so that none of them is lost. */
+        for (int i = 0; i < n; i++) {
+            Rope *done = (edits[i].begin == edits[i].end) ?
+                Rope_insert(rope, edits[i].begin, edits[i].text) :
+                Rope_delete(rope, edits[i].begin, edits[i].end);
+            if (done)
+                Delta_edit(delta, edits[i].begin, edits[i].end,
+                           strlen(edits[i].text));
+        }
+    }
+    for (int i = 0; i < n; i++) Courier_destroyCommand(batch[i]);
+    return command;
+}
+
+static RopeEdit toEdit(struct command_s command) {
+    switch (command.opcode) {
+        case COURIER_INSERT:
+            return (RopeEdit){ .begin=command.u.i.pos, .end=command.u.i.pos,
+                               .text=command.u.i.data };
+        case COURIER_DELETE:
+            return (RopeEdit){ .begin=command.u.d.from, .end=command.u.d.to,
+                               .text="" };
+        case COURIER_SPACE:
+            return (RopeEdit){ .begin=command.u.s.pos, .end=command.u.s.pos,
+                               .text=" " };
+        default:
+            return (RopeEdit){ .begin=command.u.n.pos, .end=command.u.n.pos,
+                               .text="\n" };
+    }
+}
+
+/* Counts the len bytes of text a lookup read in looked_up, and lays rope
+ * out flat once they add up to SERVER_FREEZE_RATIO times its size. If that
+ * fails, the count starts over, so that it is not tried after every lookup.
+ * Small lookups alone thus never copy a big text. */
+static void addLookup(Rope *rope, long long *looked_up, int len) {
+    *looked_up += len;
+    if (*looked_up < (long long) SERVER_FREEZE_RATIO * Rope_size(rope))
+        return;
+    if (Rope_freeze(rope)) *looked_up = 0;
+}
+
+/* Responds with lines [from, to) of rope, newlines included. The range is
+ * clamped to the lines rope has.
+ *
+ * Returns the number of bytes sent. */
+static int sendLines(Courier *courier, const Rope *rope, int from, int to) {
+    int lines = Rope_lines(rope);
+    if (from < 0) from = 0;
+    if (to > lines) to = lines;
+    if (from > to) from = to;
+
+    int begin = (from < lines) ? Rope_lineOffset(rope, from, 0) :
+        Rope_size(rope);
+    int end = (to < lines) ? Rope_lineOffset(rope, to, 0) : Rope_size(rope);
+    return sendRange(courier, rope, begin, end);
+}
+
+/* Responds with the text between positions from and to of rope. Negative
+ * positions count from the end, and the range is clamped to rope.
+ *
+ * Returns the number of bytes sent. */
+static int sendSlice(Courier *courier, const Rope *rope, int addressing,
+                     int from, int to) {
+    int size = (addressing == COURIER_ADDRESS_BYTES) ? Rope_size(rope) :
+        Rope_chars(rope);
+    if (from < 0) from += size + 1;
+    if (to < 0) to += size + 1;
+    if (from < 0) from = 0;
+    if (to > size) to = size;
+    if (from > to) from = to;
+
+    toOffset(rope, addressing, &from);
+    toOffset(rope, addressing, &to);
+    return sendRange(courier, rope, from, to);
+}
+
+/* Responds with the range [begin, end) of rope, which must be valid. Only
+ * the leaves holding it are visited, and they are sent as they are, without
+ * copying them first.
+ *
+ * Returns the number of bytes sent. */
+static int sendRange(Courier *courier, const Rope *rope, int begin, int end) {
+    struct range_s range = { .left = end - begin };
+    range.skip = Rope_iterSeek(rope, &(range.it), begin);
+    Courier_sendResponseFrom(courier, end - begin, nextInRange, &range);
+    return end - begin;
+}
+
+/* Responds with the script that turns the text the client last received
+ * from here into the text of rope, or with the whole text if that is
+ * smaller, and from then on tracks the changes from it. */
+static void sendDelta(Courier *courier, const Rope *rope, Delta *delta) {
+    char *script;
+    int len = Delta_script(delta, rope, &script);
+    if (len >= 0) {
+        struct response_s response = { .len=len, .data=script };
+        Courier_sendResponse(courier, response);
+        free(script);
+    } else {
+        struct whole_s whole = { .marked = 0 };
+        Rope_iterBegin(rope, &(whole.it));
+        Courier_sendResponseFrom(courier, Rope_size(rope) + 1, nextWhole,
+                                 &whole);
+    }
+    Delta_reset(delta, Rope_size(rope));
+}
+
+static void sendLineCount(Courier *courier, const Rope *rope) {
+    char text[16];
+    int len = snprintf(text, sizeof(text), "%d\n", Rope_lines(rope));
+
+    struct response_s response = { .len=len, .data=text };
+    Courier_sendResponse(courier, response);
+}
+
+/* Replaces rope with a new one holding the file at path, under root.
+ *
+ * Clients that speak version 2 or later are answered with an empty response
+ * on success, and with a line telling what went wrong on error. Older ones
+ * are not answered. */
+static void load(Courier *courier, const char *root, const char *path,
+                 Rope **rope) {
+    const char *error = "Not a relative path inside the root\n";
+    if (isRelativeInside(path)) {
+        Rope *loaded = loadFile(root, path);
+        error = "Could not load the file\n";
+        if (loaded) {
+            *rope = loaded;
+            error = "";
+        }
+    }
+
+    if (Courier_version(courier) < 2) return;
+    struct response_s response = { .len=strlen(error), .data=(char *) error };
+    Courier_sendResponse(courier, response);
+}
+
+/* Creates a rope with the contents of the file at path, under the directory
+ * root, which must be an absolute path with no symbolic links. The file is
+ * mapped rather than read, so its pages go straight from the page cache into
+ * the leaves of the rope.
+ *
+ * Symbolic links are followed, so the file is only opened after making sure
+ * that where it resolves to is still under root. It is opened without
+ * following a link that took the place of that file meanwhile, and without
+ * waiting, and anything but a regular file, such as a FIFO or a device that
+ * would block the server, is rejected.
+ *
+ * On success, a pointer to the new rope is returned. On error, NULL is
+ * returned. */
+static Rope *loadFile(const char *root, const char *path) {
+    int root_len = strlen(root);
+    char *joined = malloc(root_len + strlen(path) + 2);
+    if (!joined) return NULL;
+    sprintf(joined, "%s/%s", root, path);
+
+    char *resolved = realpath(joined, NULL);
+    free(joined);
+    if (!resolved) return NULL;
+
+    int fd = -1;
+    if ((strncmp(resolved, root, root_len) == 0) &&
+            ((resolved[root_len] == '/') || (root_len == 1)))
+        fd = open(resolved, O_RDONLY | O_NONBLOCK | O_NOFOLLOW);
+    free(resolved);
+    if (fd < 0) return NULL;
+
+    Rope *rope = NULL;
+    struct stat st;
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || (st.st_size > INT_MAX))
+        goto outro;
+
+    if (st.st_size == 0) {
+        rope = Rope_new();
+        goto outro;
+    }
+
+    void *buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (buf == MAP_FAILED) goto outro;
+
+    posix_madvise(buf, st.st_size, POSIX_MADV_SEQUENTIAL);
+    rope = Rope_buildFrom(buf, st.st_size);
+    munmap(buf, st.st_size);
+
+outro:
+    close(fd);
+    return rope;
+}
+
+/* Returns 1 if path is relative and none of its components is "..", so that
+ * it names something under the directory it is taken from, symbolic links
+ * aside. Otherwise, 0 is returned. */
+static int isRelativeInside(const char *path) {
+    if ((path[0] == '\0') || (path[0] == '/')) return 0;
+
+    for (const char *p = path; *p; ) {
+        const char *end = strchr(p, '/');
+        int len = end ? end - p : strlen(p);
+        if ((len == 2) && (p[0] == '.') && (p[1] == '.')) return 0;
+        p += len;
+        if (*p == '/') p++;
+    }
+    return 1;
+}
+
+/* Responds with the matches of pattern in rope, as a line of text: the
+ * position of the first one (-1 if there is none), the positions of all of
+ * them separated by spaces, or how many there are.
+ *
+ * Returns the number of bytes of rope searched. */
+static int sendMatches(Courier *courier, const Rope *rope, int addressing,
+                       int mode, const char *pattern) {
+    /* Room for one more offset, its separator and the final newline. */
+    const int ENTRY_SIZE = 16;
+    int capacity = 4 * ENTRY_SIZE;
+    char *text = malloc(capacity);
+    if (!text) {
+        /* The client waits for an answer all the same. */
+        Courier_sendResponse(courier, (struct response_s){ .len=0 });
+        return 0;
+    }
+
+    int len = 0;
+    int count = 0;
+    int pattern_len = strlen(pattern);
+    int pos = Rope_find(rope, pattern, 0);
+    int searched = Rope_size(rope);
+    if (mode == COURIER_SEARCH_FIRST) {
+        if (pos >= 0) searched = pos + pattern_len;
+        len = sprintf(text, "%d\n", fromOffset(rope, addressing, pos));
+    } else {
+        for (; pos >= 0; pos = Rope_find(rope, pattern, pos + pattern_len)) {
+            count++;
+            if (mode != COURIER_SEARCH_ALL) continue;
+
+            if (len + ENTRY_SIZE > capacity) {
+                /* Out of memory, the offsets found so far are sent. */
+                char *grown = realloc(text, capacity * 2);
+                if (!grown) break;
+                text = grown;
+                capacity *= 2;
+            }
+            len += sprintf(text + len, len ? " %d" : "%d",
+                           fromOffset(rope, addressing, pos));
+        }
+        if (mode == COURIER_SEARCH_COUNT) len = sprintf(text, "%d", count);
+        text[len++] = '\n';
+    }
+
+    struct response_s response = { .len=len, .data=text };
+    Courier_sendResponse(courier, response);
+    free(text);
+    return searched;
+}
+
+/* Responds with the hash of the range [from, to) of rope, as a line of 16
+ * hexadecimal digits, or an empty line if the range is not valid. Negative
+ * positions count from the end, so "hash 0 -1" covers the whole document. */
+static void sendHash(Courier *courier, Rope *rope, int addressing,
+                     int from, int to) {
+    char text[24] = "\n";
+    int len = 1;
+    uint64_t hash;
+
+    if (toOffset(rope, addressing, &from) || toOffset(rope, addressing, &to))
+        goto outro;
+    if (from < 0) from += Rope_size(rope) + 1;
+    if (to < 0) to += Rope_size(rope) + 1;
+    if (Rope_hash(rope, from, to, &hash) == 0)
+        len = snprintf(text, sizeof(text), "%016" PRIx64 "\n", hash);
+
+outro:
+    Courier_sendResponse(courier, (struct response_s){ .len=len, .data=text });
+}
+
+/* Turns a position sent by the client into a byte offset of rope. With
+ * character addressing, negative positions count from the end, as they do
+ * with bytes.
+ *
+ * On success, zero is returned. If rope has no such character, -1 is
+ * returned. */
+static int toOffset(const Rope *rope, int addressing, int *pos) {
+    if (addressing == COURIER_ADDRESS_BYTES) return 0;
+
+    if (*pos < 0) *pos += Rope_chars(rope) + 1;
+    *pos = Rope_charOffset(rope, *pos);
+    return (*pos < 0) ? -1 : 0;
+}
+
+/* Turns a byte offset of rope into a position for the client. */
+static int fromOffset(const Rope *rope, int addressing, int offset) {
+    if ((addressing == COURIER_ADDRESS_BYTES) || (offset < 0)) return offset;
+    return Rope_charIndex(rope, offset);
+}
+
+/* Same as Rope_lineOffset, with the column counted in the current
+ * addressing. */
+static int lineOffset(const Rope *rope, int addressing, int line,
+                      int column) {
+    if (addressing == COURIER_ADDRESS_BYTES)
+        return Rope_lineOffset(rope, line, column);
+
+    int begin = Rope_lineOffset(rope, line, 0);
+    if ((begin < 0) || (column < 0)) return -1;
+
+    /* Columns past the newline would land on a later line. */
+    int offset = Rope_charOffset(rope, Rope_charIndex(rope, begin) + column);
+    if ((offset < 0) || (Rope_lineAt(rope, offset) != line)) return -1;
+    return offset;
 }
@@ -1,9 +1,13 @@
 #define _POSIX_C_SOURCE 201709L
 #define _ISOC99_SOURCE //snprintf
+#define _DEFAULT_SOURCE //TCP_CORK
 #include "socket.h"
 
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
+#include <poll.h>
 #include <stdio.h>
 
 #define SERVER_BACKLOG 10
@@ -79,6 +83,7 @@ int socket_accept(socket_t *self, socket_t* accepted_socket) {
 }
 
 int socket_send(socket_t *self, const void* buffer, size_t length) {
+    if (length == 0) return 0;
     const char *end = (char*)buffer + length;
     do {
         int n = send(self->socket, buffer, length, 0);
@@ -89,6 +94,25 @@ int socket_send(socket_t *self, const void* buffer, size_t length) {
     return 0;
 }
 
+int socket_sendv(socket_t *self, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = writev(self->socket, iov, iovcnt);
+        if (n < 1) return -1;
+
+        /* Skip whatever was fully sent, and trim what was partially sent. */
+        while ((iovcnt > 0) && ((size_t) n >= iov->iov_len)) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
 int socket_receive(socket_t *self, void* buffer, size_t length) {
     if (length == 0) return 0;
     char *end = (char*)buffer + length;
@@ -101,6 +125,29 @@ int socket_receive(socket_t *self, void* buffer, size_t length) {
     return 0;
 }
 
+int socket_receive_some(socket_t *self, void* buffer, size_t length) {
+    return recv(self->socket, buffer, length, 0);
+}
+
+int socket_pending(socket_t *self) {
+    struct pollfd fd = { .fd=self->socket, .events=POLLIN };
+    return (poll(&fd, 1, 0) == 1) && (fd.revents & POLLIN);
+}
+
+int socket_set_nodelay(socket_t *self, int on) {
+    if (setsockopt(self->socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)))
+        return -1;
+    return 0;
+}
+
+int socket_set_cork(socket_t *self, int on) {
+#ifdef TCP_CORK
+    if (setsockopt(self->socket, IPPROTO_TCP, TCP_CORK, &on, sizeof(on)))
+        return -1;
+#endif
+    return 0;
+}
+
 void socket_shutdown(socket_t *self) {
     shutdown(self->socket, SHUT_RDWR);
 }
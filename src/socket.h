@@ -1,5 +1,6 @@
 #include <stddef.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <string.h>
 
 #ifndef SOCKET_H
@@ -15,7 +16,22 @@ int socket_bind_and_listen(socket_t *self, unsigned short port);
 int socket_connect(socket_t *self, const char* host_name, unsigned short port);
 int socket_accept(socket_t *self, socket_t* accepted_socket);
 int socket_send(socket_t *self, const void* buffer, size_t length);
+/* Sends every buffer of iov in order, with as few syscalls as the kernel
+ * allows. iov is used as scratch space and left in an unspecified state. */
+int socket_sendv(socket_t *self, struct iovec *iov, int iovcnt);
 int socket_receive(socket_t *self, void* buffer, size_t length);
+/* Receives whatever has arrived, up to length bytes, waiting only if nothing
+ * has. Returns the number of bytes received, 0 if the peer has shut down, or
+ * -1 on error. */
+int socket_receive_some(socket_t *self, void* buffer, size_t length);
+/* Returns 1 if there is data to receive right away, 0 otherwise. */
+int socket_pending(socket_t *self);
+/* Turns Nagle's algorithm off (on != 0) or back on, so that small writes go
+ * out right away instead of waiting for the previous ones to be acked. */
+int socket_set_nodelay(socket_t *self, int on);
+/* While corked (on != 0), only full segments are sent; uncorking sends what
+ * is left. Does nothing where TCP_CORK is not available. */
+int socket_set_cork(socket_t *self, int on);
 void socket_shutdown(socket_t *self);
 
 #endif
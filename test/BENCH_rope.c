@@ -0,0 +1,311 @@
+/* Benchmark of the text backends on a few editing workloads.
+ *
+ * Usage: ./BENCH_rope [rope|piece|btree] [scale]
+ *
+ * Without a backend, every backend is run. Each workload prints a line with
+ * the backend, the workload and the milliseconds it took, so runs can be
+ * compared side by side. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/rope.h"
+#include "../src/piecetable.h"
+#include "../src/btreerope.h"
+
+/* The operations every backend offers, so workloads are written once. */
+struct backend_s {
+    const char *name;
+    void *(*build)(const char *buf, int len);
+    void *(*insert)(void *self, int pos, const char *text);
+    void *(*delete)(void *self, int begin, int end);
+    int (*size)(const void *self);
+    long (*scan)(const void *self);
+    char *(*flatten)(const void *self);
+    void (*destroy)(void *self);
+};
+
+static void *ropeBuild(const char *buf, int len);
+static void *ropeInsert(void *self, int pos, const char *text);
+static void *ropeDelete(void *self, int begin, int end);
+static int ropeSize(const void *self);
+static long ropeScan(const void *self);
+static char *ropeFlatten(const void *self);
+static void ropeDestroy(void *self);
+
+static void *pieceBuild(const char *buf, int len);
+static void *pieceInsert(void *self, int pos, const char *text);
+static void *pieceDelete(void *self, int begin, int end);
+static int pieceSize(const void *self);
+static long pieceScan(const void *self);
+static char *pieceFlatten(const void *self);
+static void pieceDestroy(void *self);
+
+static void *btreeBuild(const char *buf, int len);
+static void *btreeInsert(void *self, int pos, const char *text);
+static void *btreeDelete(void *self, int begin, int end);
+static int btreeSize(const void *self);
+static long btreeScan(const void *self);
+static char *btreeFlatten(const void *self);
+static void btreeDestroy(void *self);
+
+static const struct backend_s backends[] = {
+    { "rope", ropeBuild, ropeInsert, ropeDelete, ropeSize, ropeScan,
+      ropeFlatten, ropeDestroy },
+    { "piece", pieceBuild, pieceInsert, pieceDelete, pieceSize, pieceScan,
+      pieceFlatten, pieceDestroy },
+    { "btree", btreeBuild, btreeInsert, btreeDelete, btreeSize, btreeScan,
+      btreeFlatten, btreeDestroy }
+};
+
+static void runAll(const struct backend_s *b, int scale);
+static double benchAppend(const struct backend_s *b, int scale);
+static double benchTyping(const struct backend_s *b, int scale);
+static double benchRandomEdits(const struct backend_s *b, int scale);
+static double benchLoadAndScan(const struct backend_s *b, int scale);
+static double benchFlatten(const struct backend_s *b, int scale);
+static double elapsedMs(const struct timespec *start);
+
+int main(int argc, char **argv) {
+    const char *name = (argc > 1) ? argv[1] : NULL;
+    int scale = (argc > 2) ? atoi(argv[2]) : 1;
+    if (scale < 1) scale = 1;
+
+    int found = 0;
+    for (int i = 0; i < (int) (sizeof(backends) / sizeof(backends[0])); i++) {
+        if (name && strcmp(name, backends[i].name)) continue;
+        runAll(&backends[i], scale);
+        found = 1;
+    }
+
+    if (!found) {
+        fprintf(stderr, "Unknown backend: %s\n", name);
+        return 1;
+    }
+    return 0;
+}
+
+static void runAll(const struct backend_s *b, int scale) {
+    printf("%-6s append      %8.1f ms\n", b->name, benchAppend(b, scale));
+    printf("%-6s typing      %8.1f ms\n", b->name, benchTyping(b, scale));
+    printf("%-6s random      %8.1f ms\n", b->name,
+           benchRandomEdits(b, scale));
+    printf("%-6s load+scan   %8.1f ms\n", b->name,
+           benchLoadAndScan(b, scale));
+    printf("%-6s flatten     %8.1f ms\n", b->name, benchFlatten(b, scale));
+}
+
+/* Many small appends at the end of the document, as when logging. */
+static double benchAppend(const struct backend_s *b, int scale) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    void *doc = b->build("", 0);
+    for (int i = 0; i < 200000 * scale; i++)
+        doc = b->insert(doc, b->size(doc), "line of text\n");
+    b->destroy(doc);
+
+    return elapsedMs(&start);
+}
+
+/* Bursts of single characters typed after each other, each burst somewhere
+ * else in a document that is already big. */
+static double benchTyping(const struct backend_s *b, int scale) {
+    int len = 1 << 20;
+    char *buf = malloc(len);
+    memset(buf, 'x', len);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    srand(1);
+    void *doc = b->build(buf, len);
+    for (int i = 0; i < 2000 * scale; i++) {
+        int pos = rand() % (b->size(doc) + 1);
+        for (int j = 0; j < 100; j++) doc = b->insert(doc, pos + j, "a");
+    }
+    b->destroy(doc);
+
+    free(buf);
+    return elapsedMs(&start);
+}
+
+/* Inserts and deletes of a few characters anywhere in the document. */
+static double benchRandomEdits(const struct backend_s *b, int scale) {
+    int len = 1 << 20;
+    char *buf = malloc(len);
+    memset(buf, 'x', len);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    srand(2);
+    void *doc = b->build(buf, len);
+    for (int i = 0; i < 100000 * scale; i++) {
+        int size = b->size(doc);
+        int pos = rand() % size;
+        if (rand() % 2) {
+            int end = pos + 1 + rand() % 4;
+            doc = b->delete(doc, pos, end < size ? end : size);
+        } else {
+            doc = b->insert(doc, pos, "abcd");
+        }
+    }
+    b->destroy(doc);
+
+    free(buf);
+    return elapsedMs(&start);
+}
+
+/* Builds a big document at once, and reads it all back. */
+static double benchLoadAndScan(const struct backend_s *b, int scale) {
+    int len = (1 << 26) * (scale < 16 ? scale : 16);
+    char *buf = malloc(len);
+    memset(buf, 'x', len);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    void *doc = b->build(buf, len);
+    if (b->scan(doc) != len) fprintf(stderr, "%s: bad scan\n", b->name);
+    b->destroy(doc);
+
+    free(buf);
+    return elapsedMs(&start);
+}
+
+/* Copies a big document out as a single string, as an export would. Only
+ * the copy is timed. */
+static double benchFlatten(const struct backend_s *b, int scale) {
+    int len = (1 << 26) * (scale < 16 ? scale : 16);
+    char *buf = malloc(len);
+    memset(buf, 'x', len);
+    void *doc = b->build(buf, len);
+    free(buf);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    char *s = b->flatten(doc);
+    if ((int) strlen(s) != len) fprintf(stderr, "%s: bad flatten\n", b->name);
+    double ms = elapsedMs(&start);
+
+    free(s);
+    b->destroy(doc);
+    return ms;
+}
+
+static double elapsedMs(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 +
+        (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void *ropeBuild(const char *buf, int len) {
+    return Rope_buildFrom(buf, len);
+}
+
+static void *ropeInsert(void *self, int pos, const char *text) {
+    return Rope_insert((Rope *) self, pos, text);
+}
+
+static void *ropeDelete(void *self, int begin, int end) {
+    return Rope_delete((Rope *) self, begin, end);
+}
+
+static int ropeSize(const void *self) {
+    return Rope_size((const Rope *) self);
+}
+
+static long ropeScan(const void *self) {
+    RopeIter it;
+    const char *text;
+    int len;
+    long total = 0;
+
+    Rope_iterBegin((const Rope *) self, &it);
+    while (Rope_iterNext(&it, &text, &len)) total += len;
+    return total;
+}
+
+static char *ropeFlatten(const void *self) {
+    return Rope_toString((const Rope *) self);
+}
+
+static void ropeDestroy(void *self) {
+    Rope_destroy((Rope *) self);
+}
+
+static void *pieceBuild(const char *buf, int len) {
+    return PieceTable_buildFrom(buf, len);
+}
+
+static void *pieceInsert(void *self, int pos, const char *text) {
+    return PieceTable_insert((PieceTable *) self, pos, text);
+}
+
+static void *pieceDelete(void *self, int begin, int end) {
+    return PieceTable_delete((PieceTable *) self, begin, end);
+}
+
+static int pieceSize(const void *self) {
+    return PieceTable_size((const PieceTable *) self);
+}
+
+static long pieceScan(const void *self) {
+    PieceTableIter it;
+    const char *text;
+    int len;
+    long total = 0;
+
+    PieceTable_iterBegin((const PieceTable *) self, &it);
+    while (PieceTable_iterNext(&it, &text, &len)) total += len;
+    return total;
+}
+
+static char *pieceFlatten(const void *self) {
+    return PieceTable_toString((const PieceTable *) self);
+}
+
+static void pieceDestroy(void *self) {
+    PieceTable_destroy((PieceTable *) self);
+}
+
+static void *btreeBuild(const char *buf, int len) {
+    return BTreeRope_buildFrom(buf, len);
+}
+
+static void *btreeInsert(void *self, int pos, const char *text) {
+    return BTreeRope_insert((BTreeRope *) self, pos, text);
+}
+
+static void *btreeDelete(void *self, int begin, int end) {
+    return BTreeRope_delete((BTreeRope *) self, begin, end);
+}
+
+static int btreeSize(const void *self) {
+    return BTreeRope_size((const BTreeRope *) self);
+}
+
+static long btreeScan(const void *self) {
+    BTreeRopeIter it;
+    const char *text;
+    int len;
+    long total = 0;
+
+    BTreeRope_iterBegin((const BTreeRope *) self, &it);
+    while (BTreeRope_iterNext(&it, &text, &len)) total += len;
+    return total;
+}
+
+static char *btreeFlatten(const void *self) {
+    return BTreeRope_toString((const BTreeRope *) self);
+}
+
+static void btreeDestroy(void *self) {
+    BTreeRope_destroy((BTreeRope *) self);
+}
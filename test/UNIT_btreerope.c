@@ -0,0 +1,145 @@
+/* Battery of unit tests for the project's B+tree rope. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../src/btreerope.h"
+
+static void test_emptyRope();
+static void test_buildFromUnterminatedBuffer();
+static void test_appendsFillLeaves();
+static void test_outOfRangeEditsFail();
+static void test_randomEditsMatchReference();
+
+int main(int argc, char **argv) {
+    test_emptyRope();
+    test_buildFromUnterminatedBuffer();
+    test_appendsFillLeaves();
+    test_outOfRangeEditsFail();
+    test_randomEditsMatchReference();
+    printf("All tests ok.\n");
+}
+
+static void test_emptyRope() {
+    BTreeRope *r = BTreeRope_new();
+    assert(BTreeRope_size(r) == 0);
+
+    char *s = BTreeRope_toString(r);
+    assert(strcmp(s, "") == 0);
+    free(s);
+
+    BTreeRopeIter it;
+    const char *text;
+    int len;
+    BTreeRope_iterBegin(r, &it);
+    assert(BTreeRope_iterNext(&it, &text, &len) == 0);
+
+    /* Emptied again after holding text. */
+    assert(BTreeRope_insert(r, 0, "abc") == r);
+    assert(BTreeRope_delete(r, 0, 3) == r);
+    assert(BTreeRope_size(r) == 0);
+    BTreeRope_iterBegin(r, &it);
+    assert(BTreeRope_iterNext(&it, &text, &len) == 0);
+
+    BTreeRope_destroy(r);
+}
+
+static void test_buildFromUnterminatedBuffer() {
+    const char buf[] = "hello world";
+    BTreeRope *r = BTreeRope_buildFrom(buf, 5);
+    assert(BTreeRope_size(r) == 5);
+
+    char *s = BTreeRope_toString(r);
+    assert(strcmp(s, "hello") == 0);
+    free(s);
+    BTreeRope_destroy(r);
+
+    assert(BTreeRope_buildFrom(buf, -1) == NULL);
+}
+
+static void test_appendsFillLeaves() {
+    BTreeRope *r = BTreeRope_new();
+    for (int i = 0; i < 100000; i++)
+        assert(BTreeRope_insert(r, BTreeRope_size(r), "xy") == r);
+
+    /* Every leaf but the last is full. */
+    BTreeRopeIter it;
+    const char *text;
+    int len, leaves = 0, full = 0;
+    BTreeRope_iterBegin(r, &it);
+    while (BTreeRope_iterNext(&it, &text, &len)) {
+        leaves++;
+        if (len == 1024) full++;
+    }
+    assert(full >= leaves - 1);
+    assert(BTreeRope_size(r) == 200000);
+
+    BTreeRope_destroy(r);
+}
+
+static void test_outOfRangeEditsFail() {
+    BTreeRope *r = BTreeRope_buildFrom("abc", 3);
+    assert(BTreeRope_insert(r, 4, "x") == NULL);
+    assert(BTreeRope_insert(r, -5, "x") == NULL);
+    assert(BTreeRope_delete(r, 2, 1) == NULL);
+    assert(BTreeRope_delete(r, 0, 4) == NULL);
+
+    assert(BTreeRope_insert(r, -1, "d") == r);
+    char *s = BTreeRope_toString(r);
+    assert(strcmp(s, "abcd") == 0);
+    free(s);
+
+    BTreeRope_destroy(r);
+}
+
+static void test_randomEditsMatchReference() {
+    const int N = 20000;
+    const int MAX_TEXT = 3000;
+    char *expected = malloc(N * MAX_TEXT / 8 + 1);
+    char *text = malloc(MAX_TEXT + 1);
+    int len = 0;
+    int typed = 0;
+
+    srand(12);
+    BTreeRope *r = BTreeRope_buildFrom("", 0);
+    for (int i = 0; i < N; i++) {
+        /* Half of the time, keep typing where the last insert ended. Now and
+         * then, edits span many leaves. */
+        int pos = (rand() % 2) ? typed : rand() % (len + 1);
+        int big = (rand() % 100 == 0);
+        if (pos > len) pos = len;
+        if ((pos < len) && (rand() % 3 == 0)) {
+            int most = big ? MAX_TEXT : 5;
+            int end = pos + 1 + rand() % ((len - pos) < most ?
+                                          (len - pos) : most);
+            memmove(expected + pos, expected + end, len - end);
+            len -= end - pos;
+            assert(BTreeRope_delete(r, pos, end) == r);
+        } else {
+            int n = 1 + rand() % (big ? MAX_TEXT : 3);
+            for (int j = 0; j < n; j++) text[j] = 'a' + rand() % 26;
+            text[n] = '\0';
+            memmove(expected + pos + n, expected + pos, len - pos);
+            memcpy(expected + pos, text, n);
+            len += n;
+            assert(BTreeRope_insert(r, pos, text) == r);
+            typed = pos + n;
+        }
+        assert(BTreeRope_size(r) == len);
+    }
+    expected[len] = '\0';
+
+    char *s = BTreeRope_toString(r);
+    assert(strcmp(expected, s) == 0);
+    free(s);
+
+    /* Deleting everything, from the middle out. */
+    assert(BTreeRope_delete(r, len / 2, len) == r);
+    assert(BTreeRope_delete(r, 0, len / 2) == r);
+    assert(BTreeRope_size(r) == 0);
+
+    BTreeRope_destroy(r);
+    free(text);
+    free(expected);
+}
@@ -0,0 +1,756 @@
+/* Battery of unit tests for the project's wire format. Both ends of a
+ * session run here, over a socketpair, and the bytes between them are
+ * either checked or made up by the tests. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include "../src/courier.h"
+
+/* The client end speaks through fds[0], and the server end through fds[1].
+ * Bytes written straight to fds[0] reach the server as if the client had
+ * sent them, and bytes read straight from fds[1] are what it sent. */
+struct session_s {
+    int fds[2];
+    socket_t sockets[2];
+    Courier *client;
+    Courier *server;
+};
+
+/* Bytes written to a socket one at a time, so that they arrive over many
+ * reads. */
+struct drip_s {
+    int fd;
+    const char *data;
+    int len;
+};
+
+/* The pieces of a response, for Courier_sendResponseFrom. */
+struct pieces_s {
+    const char **pieces;
+    int n;
+};
+
+static void test_everyCommandRoundTripsInVersion1();
+static void test_everyCommandRoundTripsInVersion2();
+static void test_responsesRoundTrip();
+static void test_negativeAndLargePositions();
+static void test_varintBoundaries();
+static void test_stringsAreCapped();
+static void test_rejectedCommandsKeepPositions();
+static void test_commandsSplitAcrossReads();
+static void test_commandsSplitAcrossFrames();
+static void test_hasCommandOnPartialInput();
+static void test_lengthsPastTheFrameAreRejected();
+static void test_negotiationWithVersion1Peer();
+
+static void openSession(struct session_s *self, int version);
+static void closeSession(struct session_s *self);
+static int everyCommand(struct command_s *commands);
+static void roundTrip(struct session_s *self, struct command_s command);
+static void assertSameCommand(struct command_s a, struct command_s b);
+static void assertSameString(const char *a, int a_len, const char *b,
+                             int b_len);
+static int pendingBytes(int fd);
+static int drain(int fd, char *out, int size);
+static void writeAll(int fd, const void *data, int len);
+static void *drip(void *state);
+static int nextPiece(void *state, const char **data, int *len);
+static int varintSize(unsigned int value);
+
+int main(int argc, char **argv) {
+    test_everyCommandRoundTripsInVersion1();
+    test_everyCommandRoundTripsInVersion2();
+    test_responsesRoundTrip();
+    test_negativeAndLargePositions();
+    test_varintBoundaries();
+    test_stringsAreCapped();
+    test_rejectedCommandsKeepPositions();
+    test_commandsSplitAcrossReads();
+    test_commandsSplitAcrossFrames();
+    test_hasCommandOnPartialInput();
+    test_lengthsPastTheFrameAreRejected();
+    test_negotiationWithVersion1Peer();
+    printf("All tests ok.\n");
+}
+
+static void test_everyCommandRoundTripsInVersion1() {
+    struct session_s s;
+    openSession(&s, 1);
+
+    struct command_s commands[32];
+    int n = everyCommand(commands);
+    for (int i = 0; i < n; i++) roundTrip(&s, commands[i]);
+
+    /* Buffered together, and received in order. */
+    for (int i = 0; i < n; i++)
+        assert(Courier_sendCommand(s.client, commands[i]) == 0);
+    assert(Courier_flush(s.client) == 0);
+    for (int i = 0; i < n; i++) {
+        struct command_s got = Courier_recvCommand(s.server);
+        assertSameCommand(commands[i], got);
+        Courier_destroyCommand(got);
+    }
+    assert(!Courier_hasCommand(s.server));
+
+    closeSession(&s);
+}
+
+static void test_everyCommandRoundTripsInVersion2() {
+    struct session_s s;
+    openSession(&s, 2);
+
+    struct command_s commands[32];
+    int n = everyCommand(commands);
+    for (int i = 0; i < n; i++) roundTrip(&s, commands[i]);
+
+    for (int i = 0; i < n; i++)
+        assert(Courier_sendCommand(s.client, commands[i]) == 0);
+    assert(Courier_flush(s.client) == 0);
+    for (int i = 0; i < n; i++) {
+        struct command_s got = Courier_recvCommand(s.server);
+        assertSameCommand(commands[i], got);
+        Courier_destroyCommand(got);
+    }
+    assert(!Courier_hasCommand(s.server));
+
+    /* The peer hanging up ends the session. */
+    shutdown(s.fds[0], SHUT_WR);
+    assert(Courier_recvCommand(s.server).opcode == 0);
+
+    closeSession(&s);
+}
+
+static void test_responsesRoundTrip() {
+    const char *pieces[] = { "hello", "", " ", "world\n" };
+    char *big = malloc(100001);
+    memset(big, 'x', 100000);
+    big[100000] = '\0';
+
+    for (int version = 1; version <= 2; version++) {
+        struct session_s s;
+        openSession(&s, version);
+
+        struct response_s sent = { .len=5, .data="hello" };
+        assert(Courier_sendResponse(s.server, sent) == 0);
+        struct response_s got = Courier_recvResponse(s.client);
+        assertSameString(sent.data, sent.len, got.data, got.len);
+        Courier_destroyResponse(got);
+
+        sent = (struct response_s){ .len=0, .data="" };
+        assert(Courier_sendResponse(s.server, sent) == 0);
+        got = Courier_recvResponse(s.client);
+        assertSameString("", 0, got.data, got.len);
+        Courier_destroyResponse(got);
+
+        struct pieces_s source = { .pieces=pieces, .n=4 };
+        assert(Courier_sendResponseFrom(s.server, 12, nextPiece,
+                                        &source) == 0);
+        got = Courier_recvResponse(s.client);
+        assertSameString("hello world\n", 12, got.data, got.len);
+        Courier_destroyResponse(got);
+
+        /* Longer than any buffer on the way, and longer than a string of
+         * a command may be. */
+        const char *whole[] = { big };
+        source = (struct pieces_s){ .pieces=whole, .n=1 };
+        assert(Courier_sendResponseFrom(s.server, 100000, nextPiece,
+                                        &source) == 0);
+        got = Courier_recvResponse(s.client);
+        assertSameString(big, 100000, got.data, got.len);
+        Courier_destroyResponse(got);
+
+        closeSession(&s);
+    }
+    free(big);
+}
+
+static void test_negativeAndLargePositions() {
+    const int positions[] = {
+        0, -1, 1, INT_MAX, INT_MIN, -INT_MAX, INT_MAX - 1, INT_MIN + 1,
+        1 << 20, -(1 << 20), 123456789, -123456789, 63, -64, 64, -65
+    };
+    const int n = sizeof(positions) / sizeof(positions[0]);
+
+    for (int version = 1; version <= 2; version++) {
+        struct session_s s;
+        openSession(&s, version);
+
+        /* Every jump between two of them, either way, in positions and in
+         * plain numbers alike. */
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                int p = positions[i], q = positions[j];
+                roundTrip(&s, (struct command_s){ .opcode=COURIER_INSERT,
+                    .u.i={ .pos=p, .len=1, .data="x" } });
+                roundTrip(&s, (struct command_s){ .opcode=COURIER_DELETE,
+                    .u.d={ .from=p, .to=q } });
+                roundTrip(&s, (struct command_s){ .opcode=COURIER_SPACE,
+                    .u.s={ .pos=q } });
+                roundTrip(&s, (struct command_s){ .opcode=COURIER_HASH,
+                    .u.h={ .from=q, .to=p } });
+                roundTrip(&s, (struct command_s){
+                    .opcode=COURIER_LINE_DELETE,
+                    .u.ld={ .from_line=p, .from_column=q,
+                            .to_line=q, .to_column=p } });
+            }
+        }
+        closeSession(&s);
+    }
+}
+
+static void test_varintBoundaries() {
+    struct session_s s;
+    openSession(&s, 2);
+
+    /* Numbers are zigzag encoded, so 63 and -64 are the last that fit a
+     * byte, as 0x7e and 0x7f, and 64 and -65 the first that do not. */
+    const int values[] = { 0, 63, -64, 64, -65, INT_MAX, INT_MIN };
+    const int sizes[] = { 1, 1, 1, 2, 2, 5, 5 };
+    for (int i = 0; i < 7; i++) {
+        struct command_s command = { .opcode=COURIER_LINE_PRINT,
+            .u.lp={ .from=values[i], .to=0 } };
+        assert(Courier_sendCommand(s.client, command) == 0);
+        assert(Courier_flush(s.client) == 0);
+        assert(pendingBytes(s.fds[1]) == 1 + 1 + sizes[i] + 1);
+
+        struct command_s got = Courier_recvCommand(s.server);
+        assertSameCommand(command, got);
+    }
+
+    /* Positions go as the difference from the last one: 63, 63, -64, 64,
+     * -65, and one that wraps around. */
+    const int positions[] = { 63, 126, 62, 126, 61, INT_MIN };
+    const int deltas[] = { 1, 1, 1, 2, 2, 5 };
+    for (int i = 0; i < 6; i++) {
+        struct command_s command = { .opcode=COURIER_SPACE,
+            .u.s={ .pos=positions[i] } };
+        assert(Courier_sendCommand(s.client, command) == 0);
+        assert(Courier_flush(s.client) == 0);
+        assert(pendingBytes(s.fds[1]) == 1 + 1 + deltas[i]);
+
+        struct command_s got = Courier_recvCommand(s.server);
+        assertSameCommand(command, got);
+    }
+
+    /* Lengths are not zigzag encoded: 0x7f fits a byte, and 0x80 takes
+     * two, as does the frame that holds either. */
+    char text[0x81];
+    memset(text, 'a', sizeof(text));
+    for (int len = 0x7e; len <= 0x81; len++) {
+        struct command_s command = { .opcode=COURIER_LOAD,
+            .u.l={ .len=len, .path=text } };
+        assert(Courier_sendCommand(s.client, command) == 0);
+        assert(Courier_flush(s.client) == 0);
+        int frame = 1 + varintSize(len) + len;
+        assert(pendingBytes(s.fds[1]) == varintSize(frame) + frame);
+        assert(varintSize(len) == ((len < 0x80) ? 1 : 2));
+
+        struct command_s got = Courier_recvCommand(s.server);
+        assertSameCommand(command, got);
+        Courier_destroyCommand(got);
+    }
+
+    closeSession(&s);
+}
+
+static void test_stringsAreCapped() {
+    const int LONG = COURIER_MAX_STRING_V1 + 1000;
+    char *text = malloc(LONG);
+    memset(text, 'z', LONG);
+
+    /* Version 1 goes up to what its 2 bytes of length hold, and goes past
+     * the output buffer. */
+    struct session_s s;
+    openSession(&s, 1);
+    roundTrip(&s, (struct command_s){ .opcode=COURIER_INSERT,
+        .u.i={ .pos=0, .len=COURIER_MAX_STRING_V1, .data=text } });
+    roundTrip(&s, (struct command_s){ .opcode=COURIER_REPLACE,
+        .u.r={ .from_len=COURIER_MAX_STRING_V1, .from=text,
+               .to_len=1, .to="y" } });
+
+    /* A longer string is not sent at all. */
+    struct command_s command = { .opcode=COURIER_INSERT,
+        .u.i={ .pos=0, .len=COURIER_MAX_STRING_V1 + 1, .data=text } };
+    assert(Courier_sendCommand(s.client, command) == -1);
+    assert(Courier_flush(s.client) == 0);
+    assert(pendingBytes(s.fds[1]) == 0);
+    closeSession(&s);
+
+    /* Version 2 has no such limit. */
+    openSession(&s, 2);
+    roundTrip(&s, (struct command_s){ .opcode=COURIER_INSERT,
+        .u.i={ .pos=0, .len=LONG, .data=text } });
+    roundTrip(&s, (struct command_s){ .opcode=COURIER_REPLACE,
+        .u.r={ .from_len=LONG, .from=text, .to_len=LONG, .to=text } });
+    closeSession(&s);
+
+    /* But a string longer than any command is not received from a peer
+     * that sends it anyway: insert at 0, with a length of 2^24 + 1, in a
+     * frame that claims to hold all of it. */
+    openSession(&s, 2);
+    const unsigned char frame[] = { 0x88, 0x80, 0x80, 0x08, 0x02, 0x00,
+                                    0x81, 0x80, 0x80, 0x08 };
+    writeAll(s.fds[0], frame, sizeof(frame));
+    assert(Courier_recvCommand(s.server).opcode == -1);
+    closeSession(&s);
+
+    free(text);
+}
+
+static void test_rejectedCommandsKeepPositions() {
+    char *text = malloc(COURIER_MAX_COMMAND_FRAME);
+    memset(text, 'z', COURIER_MAX_COMMAND_FRAME);
+
+    /* In version 2, a string as long as the longest command leaves no room
+     * for the rest of the command. */
+    const int too_long[] = { COURIER_MAX_STRING_V1 + 1,
+                             COURIER_MAX_COMMAND_FRAME };
+    for (int version = 1; version <= 2; version++) {
+        struct session_s s;
+        openSession(&s, version);
+        roundTrip(&s, (struct command_s){ .opcode=COURIER_SPACE,
+            .u.s={ .pos=10 } });
+
+        /* An insert too long to send, or with a length that makes no
+         * sense, leaves the positions as they were, so the delete after it
+         * arrives as it was sent. */
+        const int lens[] = { too_long[version - 1], -1 };
+        for (int i = 0; i < 2; i++) {
+            struct command_s command = { .opcode=COURIER_INSERT,
+                .u.i={ .pos=1000 + i, .len=lens[i], .data=text } };
+            assert(Courier_sendCommand(s.client, command) == -1);
+            roundTrip(&s, (struct command_s){ .opcode=COURIER_DELETE,
+                .u.d={ .from=5, .to=7 } });
+        }
+        closeSession(&s);
+    }
+    free(text);
+}
+
+static void test_commandsSplitAcrossReads() {
+    for (int version = 1; version <= 2; version++) {
+        struct session_s s;
+        openSession(&s, version);
+
+        struct command_s commands[32];
+        int n = everyCommand(commands);
+        for (int i = 0; i < n; i++)
+            assert(Courier_sendCommand(s.client, commands[i]) == 0);
+        assert(Courier_flush(s.client) == 0);
+
+        /* What was sent is taken back, and sent again a byte at a time
+         * while the server is receiving it. */
+        char bytes[4096];
+        int len = drain(s.fds[1], bytes, sizeof(bytes));
+        struct drip_s d = { .fd=s.fds[0], .data=bytes, .len=len };
+        pthread_t writer;
+        assert(pthread_create(&writer, NULL, drip, &d) == 0);
+
+        for (int i = 0; i < n; i++) {
+            struct command_s got = Courier_recvCommand(s.server);
+            assertSameCommand(commands[i], got);
+            Courier_destroyCommand(got);
+        }
+        pthread_join(writer, NULL);
+        assert(!Courier_hasCommand(s.server));
+
+        closeSession(&s);
+    }
+}
+
+static void test_commandsSplitAcrossFrames() {
+    struct session_s s;
+    openSession(&s, 2);
+
+    /* Each flush is a frame: some hold one command, some many. */
+    struct command_s commands[32];
+    int n = everyCommand(commands);
+    int frames = 0;
+    for (int i = 0; i < n; i++) {
+        assert(Courier_sendCommand(s.client, commands[i]) == 0);
+        if (i % 3 != 1) {
+            assert(Courier_flush(s.client) == 0);
+            frames++;
+        }
+    }
+    assert(Courier_flush(s.client) == 0);
+    assert(frames > 1);
+
+    for (int i = 0; i < n; i++) {
+        assert(Courier_hasCommand(s.server));
+        struct command_s got = Courier_recvCommand(s.server);
+        assertSameCommand(commands[i], got);
+        Courier_destroyCommand(got);
+    }
+    assert(!Courier_hasCommand(s.server));
+
+    /* Frames made up by hand, of lines 1 to 2 and of lines 3 to 4, then
+     * both in one frame, and an empty frame before a last command. */
+    const unsigned char bytes[] = {
+        0x03, 0x16, 0x02, 0x04,
+        0x03, 0x16, 0x06, 0x08,
+        0x06, 0x16, 0x02, 0x04, 0x16, 0x06, 0x08,
+        0x00, 0x01, 0x18
+    };
+    writeAll(s.fds[0], bytes, sizeof(bytes));
+    for (int i = 0; i < 4; i++) {
+        struct command_s got = Courier_recvCommand(s.server);
+        assert(got.opcode == COURIER_LINE_PRINT);
+        assert(got.u.lp.from == ((i % 2) ? 3 : 1));
+        assert(got.u.lp.to == ((i % 2) ? 4 : 2));
+    }
+    assert(Courier_recvCommand(s.server).opcode == COURIER_LINES);
+
+    closeSession(&s);
+}
+
+static void test_hasCommandOnPartialInput() {
+    struct command_s first = { .opcode=COURIER_INSERT,
+        .u.i={ .pos=-7, .len=11, .data="hello world" } };
+    struct command_s second = { .opcode=COURIER_REPLACE,
+        .u.r={ .from_len=3, .from="abc", .to_len=4, .to="wxyz" } };
+
+    /* In version 2, the second command goes in a frame of its own, or in
+     * the same frame as the first. */
+    for (int mode = 0; mode < 3; mode++) {
+        int version = (mode == 0) ? 1 : 2;
+        struct session_s s;
+        openSession(&s, version);
+
+        char bytes[256];
+        assert(Courier_sendCommand(s.client, first) == 0);
+        if (mode != 2) assert(Courier_flush(s.client) == 0);
+        assert(Courier_sendCommand(s.client, second) == 0);
+        assert(Courier_flush(s.client) == 0);
+        int len = drain(s.fds[1], bytes, sizeof(bytes));
+
+        /* Where the first command ends, counting the header of its frame,
+         * which in mode 2 is that of both. */
+        int split = (version == 1) ? 4 + 4 + 2 + 11 : 1 + 1 + 1 + 1 + 11;
+
+        for (int cut = split; cut < len; cut++) {
+            writeAll(s.fds[0], bytes, cut);
+            struct command_s got = Courier_recvCommand(s.server);
+            assertSameCommand(first, got);
+            Courier_destroyCommand(got);
+
+            assert(!Courier_hasCommand(s.server));
+            writeAll(s.fds[0], bytes + cut, len - cut);
+            assert(Courier_hasCommand(s.server));
+
+            got = Courier_recvCommand(s.server);
+            assertSameCommand(second, got);
+            Courier_destroyCommand(got);
+            assert(!Courier_hasCommand(s.server));
+
+            /* The positions each end remembers are the same again. */
+            assert(Courier_sendCommand(s.client, first) == 0);
+            if (mode != 2) assert(Courier_flush(s.client) == 0);
+            assert(Courier_sendCommand(s.client, second) == 0);
+            assert(Courier_flush(s.client) == 0);
+            assert(drain(s.fds[1], bytes, sizeof(bytes)) == len);
+        }
+
+        /* Nothing at all, and the first command cut short. */
+        assert(!Courier_hasCommand(s.server));
+        writeAll(s.fds[0], bytes, split - 1);
+        assert(Courier_hasCommand(s.server));
+        writeAll(s.fds[0], bytes + split - 1, len - split + 1);
+        for (int i = 0; i < 2; i++)
+            Courier_destroyCommand(Courier_recvCommand(s.server));
+        assert(!Courier_hasCommand(s.server));
+
+        closeSession(&s);
+    }
+}
+
+static void test_lengthsPastTheFrameAreRejected() {
+    /* An insert of 10 bytes, in a frame of 6 that holds only 3 of them. */
+    struct session_s s;
+    openSession(&s, 2);
+    const unsigned char insert[] = { 0x06, 0x02, 0x00, 0x0a, 'a', 'b', 'c',
+                                     0x02, 0x00, 0x00 };
+    writeAll(s.fds[0], insert, sizeof(insert));
+    assert(Courier_recvCommand(s.server).opcode == -1);
+    closeSession(&s);
+
+    /* A response of 0x0fffffff bytes, in a frame of 7. */
+    openSession(&s, 2);
+    const unsigned char response[] = { 0x07, 0xff, 0xff, 0xff, 0x7f,
+                                       'a', 'b', 'c' };
+    writeAll(s.fds[1], response, sizeof(response));
+    assert(Courier_recvResponse(s.client).len == -1);
+    closeSession(&s);
+}
+
+static void test_negotiationWithVersion1Peer() {
+    struct session_s s;
+    char bytes[64];
+
+    /* A server that does not know the hello hangs up on it. */
+    openSession(&s, 1);
+    shutdown(s.fds[1], SHUT_WR);
+    assert(Courier_hello(s.client) == -1);
+    assert(Courier_version(s.client) == 1);
+    closeSession(&s);
+
+    /* One that only speaks version 1 answers with it, and both go on in
+     * version 1. */
+    openSession(&s, 1);
+    const unsigned char one[] = { 0, 0, 0, 1 };
+    writeAll(s.fds[1], one, 4);
+    assert(Courier_hello(s.client) == 0);
+    assert(Courier_version(s.client) == 1);
+    assert(drain(s.fds[1], bytes, sizeof(bytes)) == 8);
+    roundTrip(&s, (struct command_s){ .opcode=COURIER_SPACE,
+        .u.s={ .pos=-3 } });
+    closeSession(&s);
+
+    /* Versions nobody speaks are rejected. */
+    const unsigned char bad[][4] = { { 0, 0, 0, 3 }, { 0, 0, 0, 0 } };
+    for (int i = 0; i < 2; i++) {
+        openSession(&s, 1);
+        writeAll(s.fds[1], bad[i], 4);
+        assert(Courier_hello(s.client) == -1);
+        assert(Courier_version(s.client) == 1);
+        closeSession(&s);
+    }
+
+    /* A client that only speaks version 1 gets version 1 back, and the
+     * server stays in version 1. One that speaks a later version than the
+     * server gets the server's. */
+    const int asked[] = { 1, 9 };
+    const int agreed[] = { 1, COURIER_VERSION };
+    for (int i = 0; i < 2; i++) {
+        openSession(&s, 1);
+        unsigned char hello[] = { 0, 0, 0, COURIER_HELLO, 0, 0, 0, asked[i],
+                                  0, 0, 0, COURIER_UNDO };
+        int len = sizeof(hello);
+        if (agreed[i] == 2) {
+            hello[len - 4] = 0x01;
+            hello[len - 3] = 2 * COURIER_UNDO;
+            len -= 2;
+        }
+        writeAll(s.fds[0], hello, len);
+        assert(Courier_recvCommand(s.server).opcode == COURIER_UNDO);
+        assert(Courier_version(s.server) == agreed[i]);
+        assert(drain(s.fds[0], bytes, sizeof(bytes)) == 4);
+        assert(memcmp(bytes, "\0\0\0", 3) == 0);
+        assert(bytes[3] == agreed[i]);
+        closeSession(&s);
+    }
+}
+
+/* Starts a session over a new socketpair, and brings both ends to version.
+ * Each end is driven with bytes made up here, so that neither has to wait
+ * on the other. */
+static void openSession(struct session_s *self, int version) {
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, self->fds) == 0);
+    self->sockets[0] = (socket_t){ .socket=self->fds[0] };
+    self->sockets[1] = (socket_t){ .socket=self->fds[1] };
+    self->client = Courier_new(self->sockets);
+    self->server = Courier_new(self->sockets + 1);
+    assert(self->client && self->server);
+    if (version == 1) return;
+
+    /* A hello in version 1, and then a frame holding LINES. */
+    const unsigned char hello[] = { 0, 0, 0, COURIER_HELLO, 0, 0, 0, 2,
+                                    0x01, 2 * COURIER_LINES };
+    writeAll(self->fds[0], hello, sizeof(hello));
+    assert(Courier_recvCommand(self->server).opcode == COURIER_LINES);
+
+    /* The server's answer is what the client reads. */
+    assert(Courier_hello(self->client) == 0);
+    char sent[8];
+    assert(drain(self->fds[1], sent, sizeof(sent)) == 8);
+    assert(memcmp(sent, hello, 8) == 0);
+
+    assert(Courier_version(self->client) == 2);
+    assert(Courier_version(self->server) == 2);
+}
+
+static void closeSession(struct session_s *self) {
+    Courier_destroy(self->client);
+    Courier_destroy(self->server);
+    close(self->fds[0]);
+    close(self->fds[1]);
+}
+
+/* Fills commands with one of each opcode, and returns how many. */
+static int everyCommand(struct command_s *commands) {
+    int n = 0;
+    commands[n++] = (struct command_s){ .opcode=COURIER_INSERT,
+        .u.i={ .pos=3, .len=5, .data="hello" } };
+    commands[n++] = (struct command_s){ .opcode=COURIER_INSERT,
+        .u.i={ .pos=0, .len=0, .data="" } };
+    commands[n++] = (struct command_s){ .opcode=COURIER_DELETE,
+        .u.d={ .from=2, .to=-1 } };
+    commands[n++] = (struct command_s){ .opcode=COURIER_SPACE,
+        .u.s={ .pos=7 } };
+    commands[n++] = (struct command_s){ .opcode=COURIER_NEWLINE,
+        .u.n={ .pos=-2 } };
+    commands[n++] = (struct command_s){ .opcode=COURIER_PRINT };
+    commands[n++] = (struct command_s){ .opcode=COURIER_CHECKPOINT };
+    commands[n++] = (struct command_s){ .opcode=COURIER_UNDO };
+    commands[n++] = (struct command_s){ .opcode=COURIER_REDO };
+    commands[n++] = (struct command_s){ .opcode=COURIER_LINE_INSERT,
+        .u.li={ .line=4, .column=-1, .len=3, .data="a\nb" } };
+    commands[n++] = (struct command_s){ .opcode=COURIER_LINE_DELETE,
+        .u.ld={ .from_line=1, .from_column=2, .to_line=3,
+                .to_column=4 } };
+    commands[n++] = (struct command_s){ .opcode=COURIER_LINE_PRINT,
+        .u.lp={ .from=0, .to=1000 } };
+    commands[n++] = (struct command_s){ .opcode=COURIER_LINES };
+    commands[n++] = (struct command_s){ .opcode=COURIER_LOAD,
+        .u.l={ .len=7, .path="doc.txt" } };
+    commands[n++] = (struct command_s){ .opcode=COURIER_SEARCH,
+        .u.f={ .mode=COURIER_SEARCH_ALL, .len=2, .data="lo" } };
+    commands[n++] = (struct command_s){ .opcode=COURIER_REPLACE,
+        .u.r={ .from_len=2, .from="lo", .to_len=0, .to="" } };
+    commands[n++] = (struct command_s){ .opcode=COURIER_ADDRESSING,
+        .u.a={ .mode=COURIER_ADDRESS_CHARS } };
+    commands[n++] = (struct command_s){ .opcode=COURIER_HASH,
+        .u.h={ .from=-5, .to=-1 } };
+    commands[n++] = (struct command_s){ .opcode=COURIER_PRINT_RANGE,
+        .u.pr={ .from=1, .to=5 } };
+    commands[n++] = (struct command_s){ .opcode=COURIER_DELTA_PRINT };
+    return n;
+}
+
+/* Sends command from the client, and checks the server receives the same
+ * and nothing more. */
+static void roundTrip(struct session_s *self, struct command_s command) {
+    assert(Courier_sendCommand(self->client, command) == 0);
+    assert(Courier_flush(self->client) == 0);
+
+    struct command_s got = Courier_recvCommand(self->server);
+    assertSameCommand(command, got);
+    Courier_destroyCommand(got);
+    assert(!Courier_hasCommand(self->server));
+}
+
+static void assertSameCommand(struct command_s a, struct command_s b) {
+    assert(a.opcode == b.opcode);
+    switch (a.opcode) {
+        case COURIER_INSERT:
+            assert(a.u.i.pos == b.u.i.pos);
+            assertSameString(a.u.i.data, a.u.i.len, b.u.i.data, b.u.i.len);
+            break;
+        case COURIER_DELETE:
+            assert((a.u.d.from == b.u.d.from) && (a.u.d.to == b.u.d.to));
+            break;
+        case COURIER_SPACE:
+            assert(a.u.s.pos == b.u.s.pos);
+            break;
+        case COURIER_NEWLINE:
+            assert(a.u.n.pos == b.u.n.pos);
+            break;
+        case COURIER_LINE_INSERT:
+            assert(a.u.li.line == b.u.li.line);
+            assert(a.u.li.column == b.u.li.column);
+            assertSameString(a.u.li.data, a.u.li.len, b.u.li.data,
+                             b.u.li.len);
+            break;
+        case COURIER_LINE_DELETE:
+            assert(a.u.ld.from_line == b.u.ld.from_line);
+            assert(a.u.ld.from_column == b.u.ld.from_column);
+            assert(a.u.ld.to_line == b.u.ld.to_line);
+            assert(a.u.ld.to_column == b.u.ld.to_column);
+            break;
+        case COURIER_LINE_PRINT:
+            assert((a.u.lp.from == b.u.lp.from) && (a.u.lp.to == b.u.lp.to));
+            break;
+        case COURIER_LOAD:
+            assertSameString(a.u.l.path, a.u.l.len, b.u.l.path, b.u.l.len);
+            break;
+        case COURIER_SEARCH:
+            assert(a.u.f.mode == b.u.f.mode);
+            assertSameString(a.u.f.data, a.u.f.len, b.u.f.data, b.u.f.len);
+            break;
+        case COURIER_REPLACE:
+            assertSameString(a.u.r.from, a.u.r.from_len, b.u.r.from,
+                             b.u.r.from_len);
+            assertSameString(a.u.r.to, a.u.r.to_len, b.u.r.to, b.u.r.to_len);
+            break;
+        case COURIER_ADDRESSING:
+            assert(a.u.a.mode == b.u.a.mode);
+            break;
+        case COURIER_HASH:
+            assert((a.u.h.from == b.u.h.from) && (a.u.h.to == b.u.h.to));
+            break;
+        case COURIER_PRINT_RANGE:
+            assert((a.u.pr.from == b.u.pr.from) && (a.u.pr.to == b.u.pr.to));
+            break;
+        default:
+            break;
+    }
+}
+
+/* Strings received are null-terminated, past their length. */
+static void assertSameString(const char *a, int a_len, const char *b,
+                             int b_len) {
+    assert(a_len == b_len);
+    assert(b && (memcmp(a, b, a_len) == 0) && (b[b_len] == '\0'));
+}
+
+static int pendingBytes(int fd) {
+    int n;
+    assert(ioctl(fd, FIONREAD, &n) == 0);
+    return n;
+}
+
+/* Reads whatever has arrived at fd into out, and returns its length. */
+static int drain(int fd, char *out, int size) {
+    int len = 0;
+    while (pendingBytes(fd) > 0) {
+        int n = read(fd, out + len, size - len);
+        assert(n > 0);
+        len += n;
+    }
+    return len;
+}
+
+static void writeAll(int fd, const void *data, int len) {
+    const char *p = data;
+    while (len > 0) {
+        int n = write(fd, p, len);
+        assert(n > 0);
+        p += n;
+        len -= n;
+    }
+}
+
+static void *drip(void *state) {
+    struct drip_s *d = state;
+    struct timespec pause = { .tv_sec=0, .tv_nsec=20000 };
+    for (int i = 0; i < d->len; i++) {
+        writeAll(d->fd, d->data + i, 1);
+        nanosleep(&pause, NULL);
+    }
+    return NULL;
+}
+
+static int nextPiece(void *state, const char **data, int *len) {
+    struct pieces_s *self = state;
+    if (self->n == 0) return 0;
+
+    *data = self->pieces[0];
+    *len = strlen(self->pieces[0]);
+    self->pieces++;
+    self->n--;
+    return 1;
+}
+
+static int varintSize(unsigned int value) {
+    int n = 1;
+    while (value >>= 7) n++;
+    return n;
+}
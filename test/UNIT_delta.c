@@ -0,0 +1,179 @@
+/* Battery of unit tests for the project's delta tracking. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../src/rope.h"
+#include "../src/delta.h"
+
+static void test_unchangedTextHasEmptyScript();
+static void test_typingGrowsASingleChange();
+static void test_scriptsRebuildEditedText();
+static void test_wholeTextWhenScriptIsBigger();
+static void test_badScriptsAreRejected();
+
+int main(int argc, char **argv) {
+    test_unchangedTextHasEmptyScript();
+    test_typingGrowsASingleChange();
+    test_scriptsRebuildEditedText();
+    test_wholeTextWhenScriptIsBigger();
+    test_badScriptsAreRejected();
+    printf("All tests ok.\n");
+}
+
+static void test_unchangedTextHasEmptyScript() {
+    Rope *r = Rope_newFrom("hello world");
+    Delta *d = Delta_new(Rope_size(r));
+
+    char *script;
+    assert(Delta_script(d, r, &script) == 0);
+    free(script);
+
+    /* Text inserted and deleted again leaves nothing to send. */
+    assert(Delta_edit(d, 5, 5, 3) == 0);
+    assert(Delta_edit(d, 5, 8, 0) == 0);
+    assert(Delta_script(d, r, &script) == 0);
+    free(script);
+
+    /* Nor do edits out of range. */
+    assert(Delta_edit(d, 12, 12, 1) == -1);
+    assert(Delta_edit(d, 3, 2, 0) == -1);
+    assert(Delta_script(d, r, &script) == 0);
+    free(script);
+
+    Delta_destroy(d);
+    Rope_destroy(r);
+}
+
+static void test_typingGrowsASingleChange() {
+    const char *old = "0123456789abcdefghijklmnopqrstuvwxyz";
+    Rope *r = Rope_newFrom(old);
+    Delta *d = Delta_new(Rope_size(r));
+
+    for (int i = 0; i < 5; i++) {
+        assert(Rope_insert(r, 10 + i, "x") == r);
+        assert(Delta_edit(d, 10 + i, 10 + i, 1) == 0);
+    }
+
+    char *script;
+    int len = Delta_script(d, r, &script);
+    assert(len == 9);
+    assert(memcmp(script, "=\n+\5xxxxx", 9) == 0);
+
+    int new_len;
+    char *text = Delta_apply(old, strlen(old), script, len, &new_len);
+    assert(strcmp(text, "0123456789xxxxxabcdefghijklmnopqrstuvwxyz") == 0);
+    assert(new_len == 41);
+
+    free(text);
+    free(script);
+    Delta_destroy(d);
+    Rope_destroy(r);
+}
+
+static void test_scriptsRebuildEditedText() {
+    const int ROUNDS = 200;
+    const int EDITS = 50;
+    Rope *r = Rope_new();
+    Delta *d = Delta_new(0);
+    char *held = calloc(1, 1);
+    int held_len = 0;
+
+    srand(25);
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < EDITS; i++) {
+            /* Some edits are out of range, or count from the end. */
+            int size = Rope_size(r);
+            int begin = rand() % (size + 3) - 1;
+            int end = begin + ((rand() % 2) ? rand() % 4 : 0);
+            char text[4] = "abc";
+            text[rand() % 4] = '\0';
+            if (begin == end) {
+                Rope *done = Rope_insert(r, begin, text);
+                assert(Delta_edit(d, begin, end, strlen(text)) ==
+                       (done ? 0 : -1));
+            } else {
+                Rope *done = Rope_delete(r, begin, end);
+                assert(Delta_edit(d, begin, end, 0) == (done ? 0 : -1));
+            }
+        }
+
+        char *script;
+        int len = Delta_script(d, r, &script);
+        if (len < 0) {
+            /* The whole text goes instead. */
+            char *whole = Rope_toString(r);
+            len = strlen(whole) + 1;
+            script = malloc(len);
+            script[0] = '*';
+            memcpy(script + 1, whole, len - 1);
+            free(whole);
+        } else {
+            assert(len <= Rope_size(r));
+        }
+
+        int new_len;
+        char *text = Delta_apply(held, held_len, script, len, &new_len);
+        char *expected = Rope_toString(r);
+        assert(text && (strcmp(text, expected) == 0));
+        assert(new_len == Rope_size(r));
+
+        free(expected);
+        free(script);
+        free(held);
+        held = text;
+        held_len = new_len;
+        Delta_reset(d, Rope_size(r));
+    }
+
+    free(held);
+    Delta_destroy(d);
+    Rope_destroy(r);
+}
+
+static void test_wholeTextWhenScriptIsBigger() {
+    Rope *r = Rope_newFrom("abc");
+    Delta *d = Delta_new(3);
+
+    /* Replacing everything costs more than sending it. */
+    assert(Rope_delete(r, 0, 3) == r);
+    assert(Rope_insert(r, 0, "xyz") == r);
+    assert(Delta_edit(d, 0, 3, 0) == 0);
+    assert(Delta_edit(d, 0, 0, 3) == 0);
+    char *script;
+    assert(Delta_script(d, r, &script) == -1);
+
+    /* Changes not tracked are sent whole too. */
+    Delta_reset(d, 3);
+    Delta_invalidate(d);
+    assert(Delta_script(d, r, &script) == -1);
+    Delta_reset(d, 3);
+    assert(Delta_script(d, r, &script) == 0);
+    free(script);
+
+    int len;
+    char *text = Delta_apply("abc", 3, "*hello", 6, &len);
+    assert(strcmp(text, "hello") == 0);
+    assert(len == 5);
+    free(text);
+
+    Delta_destroy(d);
+    Rope_destroy(r);
+}
+
+static void test_badScriptsAreRejected() {
+    int len;
+    /* Keeping or dropping past the end of the text. */
+    assert(Delta_apply("abc", 3, "=\4", 2, &len) == NULL);
+    assert(Delta_apply("abc", 3, "=\1-\3", 4, &len) == NULL);
+    /* Inserting more than follows. */
+    assert(Delta_apply("abc", 3, "+\3ab", 4, &len) == NULL);
+    /* Unknown tags, and lengths cut short. */
+    assert(Delta_apply("abc", 3, "?\1", 2, &len) == NULL);
+    assert(Delta_apply("abc", 3, "=\x81", 2, &len) == NULL);
+
+    char *text = Delta_apply("abc", 3, "=\1-\1+\2xy", 8, &len);
+    assert(strcmp(text, "axyc") == 0);
+    free(text);
+}
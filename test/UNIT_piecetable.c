@@ -0,0 +1,124 @@
+/* Battery of unit tests for the project's piece table. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../src/piecetable.h"
+
+static void test_emptyTable();
+static void test_buildFromUnterminatedBuffer();
+static void test_appendsGrowOnePiece();
+static void test_outOfRangeEditsFail();
+static void test_randomEditsMatchReference();
+
+int main(int argc, char **argv) {
+    test_emptyTable();
+    test_buildFromUnterminatedBuffer();
+    test_appendsGrowOnePiece();
+    test_outOfRangeEditsFail();
+    test_randomEditsMatchReference();
+    printf("All tests ok.\n");
+}
+
+static void test_emptyTable() {
+    PieceTable *t = PieceTable_new();
+    assert(PieceTable_size(t) == 0);
+
+    char *s = PieceTable_toString(t);
+    assert(strcmp(s, "") == 0);
+    free(s);
+
+    PieceTableIter it;
+    const char *text;
+    int len;
+    PieceTable_iterBegin(t, &it);
+    assert(PieceTable_iterNext(&it, &text, &len) == 0);
+
+    PieceTable_destroy(t);
+}
+
+static void test_buildFromUnterminatedBuffer() {
+    const char buf[] = "hello world";
+    PieceTable *t = PieceTable_buildFrom(buf, 5);
+    assert(PieceTable_size(t) == 5);
+
+    char *s = PieceTable_toString(t);
+    assert(strcmp(s, "hello") == 0);
+    free(s);
+    PieceTable_destroy(t);
+
+    assert(PieceTable_buildFrom(buf, -1) == NULL);
+}
+
+static void test_appendsGrowOnePiece() {
+    PieceTable *t = PieceTable_buildFrom("abc", 3);
+    for (int i = 0; i < 1000; i++)
+        assert(PieceTable_insert(t, PieceTable_size(t), "xy") == t);
+
+    /* The original text, then every append in a single piece. */
+    PieceTableIter it;
+    const char *text;
+    int len, pieces = 0;
+    PieceTable_iterBegin(t, &it);
+    while (PieceTable_iterNext(&it, &text, &len)) pieces++;
+    assert(pieces == 2);
+    assert(PieceTable_size(t) == 2003);
+
+    PieceTable_destroy(t);
+}
+
+static void test_outOfRangeEditsFail() {
+    PieceTable *t = PieceTable_buildFrom("abc", 3);
+    assert(PieceTable_insert(t, 4, "x") == NULL);
+    assert(PieceTable_insert(t, -5, "x") == NULL);
+    assert(PieceTable_delete(t, 2, 1) == NULL);
+    assert(PieceTable_delete(t, 0, 4) == NULL);
+
+    assert(PieceTable_insert(t, -1, "d") == t);
+    char *s = PieceTable_toString(t);
+    assert(strcmp(s, "abcd") == 0);
+    free(s);
+
+    PieceTable_destroy(t);
+}
+
+static void test_randomEditsMatchReference() {
+    const int N = 20000;
+    char *expected = malloc(4 * N + 1);
+    int len = 0;
+    int typed = 0;
+    char text[4] = "abc";
+
+    srand(4);
+    PieceTable *t = PieceTable_new();
+    for (int i = 0; i < N; i++) {
+        /* Half of the time, keep typing where the last insert ended. */
+        int pos = (rand() % 2) ? typed : rand() % (len + 1);
+        if (pos > len) pos = len;
+        if ((pos < len) && (rand() % 3 == 0)) {
+            int end = pos + 1 + rand() % ((len - pos) < 5 ? (len - pos) : 5);
+            memmove(expected + pos, expected + end, len - end);
+            len -= end - pos;
+            assert(PieceTable_delete(t, pos, end) == t);
+        } else {
+            int n = 1 + rand() % 3;
+            text[n] = '\0';
+            memmove(expected + pos + n, expected + pos, len - pos);
+            memcpy(expected + pos, text, n);
+            len += n;
+            assert(PieceTable_insert(t, pos, text) == t);
+            typed = pos + n;
+            text[n] = "abc"[n];
+        }
+        assert(PieceTable_size(t) == len);
+    }
+    expected[len] = '\0';
+
+    char *s = PieceTable_toString(t);
+    assert(strcmp(expected, s) == 0);
+    free(s);
+
+    PieceTable_destroy(t);
+    free(expected);
+}
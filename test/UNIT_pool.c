@@ -0,0 +1,64 @@
+/* Battery of unit tests for the project's slab allocator. */
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "../src/pool.h"
+
+static void test_allocatedObjectsDoNotOverlap();
+static void test_freedObjectIsReused();
+static void test_mergedObjectsStayValid();
+
+int main(int argc, char **argv) {
+    test_allocatedObjectsDoNotOverlap();
+    test_freedObjectIsReused();
+    test_mergedObjectsStayValid();
+    printf("All tests ok.\n");
+}
+
+static void test_allocatedObjectsDoNotOverlap() {
+    const int N = 1000;
+    char *objects[N];
+
+    Pool *pool = Pool_new(24);
+    for (int i = 0; i < N; i++) {
+        objects[i] = Pool_alloc(pool);
+        memset(objects[i], i % 128, 24);
+    }
+
+    for (int i = 0; i < N; i++) {
+        assert(objects[i][0] == i % 128);
+        assert(objects[i][23] == i % 128);
+    }
+
+    Pool_destroy(pool);
+}
+
+static void test_freedObjectIsReused() {
+    Pool *pool = Pool_new(64);
+
+    void *a = Pool_alloc(pool);
+    Pool_alloc(pool);
+    Pool_free(pool, a);
+    assert(a == Pool_alloc(pool));
+
+    Pool_destroy(pool);
+}
+
+static void test_mergedObjectsStayValid() {
+    Pool *self = Pool_new(16);
+    Pool *other = Pool_new(16);
+
+    char *a = Pool_alloc(self);
+    char *b = Pool_alloc(other);
+    strcpy(a, "self");
+    strcpy(b, "other");
+
+    Pool_merge(self, other);
+    for (int i = 0; i < 100; i++) strcpy(Pool_alloc(self), "new");
+
+    assert(strcmp(a, "self") == 0);
+    assert(strcmp(b, "other") == 0);
+
+    Pool_destroy(self);
+}
@@ -38,6 +38,49 @@ static void test_deleteEndLeafOnly();
 
 static void test_growTreeFromEmptyRope();
 
+static void test_manyAppendsKeepOrder();
+static void test_randomEditsMatchReference();
+
+static void test_longTextSpansSeveralChunks();
+static void test_deleteAcrossChunks();
+
+static void test_joinRopeSharingAnotherPool();
+
+static void test_iterateEmptyRope();
+static void test_iterateVisitsLeavesInOrder();
+
+static void test_cursorEditsMatchReference();
+
+static void test_snapshotKeepsOldVersion();
+
+static void test_linesOfEmptyRope();
+static void test_lineOffsetsMatchReference();
+static void test_substringAcrossChunks();
+
+static void test_buildFromUnterminatedBuffer();
+
+static void test_findMatchesReference();
+static void test_findAcrossManyLeaves();
+
+static char *replaceReference(const char *text, const char *from,
+                              const char *to);
+static void test_replaceAllMatchesReference();
+static void test_replaceAllKeepsSnapshot();
+
+static void test_charOffsetsMatchReference();
+
+static void test_toStringOfLargeRope();
+
+static void test_hashDependsOnlyOnText();
+
+static void test_iterSeekReadsRange();
+
+static void test_applyBatchMatchesSequential();
+
+static void test_deletedTextIsReclaimedLater();
+
+static void test_frozenReadsMatchTree();
+
 int main(int argc, char **argv) {
     test_sizeOfEmptyStringIsZero();
     test_sizeLeaf();
@@ -71,6 +114,47 @@ int main(int argc, char **argv) {
 
     test_growTreeFromEmptyRope();
 
+    test_manyAppendsKeepOrder();
+    test_randomEditsMatchReference();
+
+    test_longTextSpansSeveralChunks();
+    test_deleteAcrossChunks();
+
+    test_joinRopeSharingAnotherPool();
+
+    test_iterateEmptyRope();
+    test_iterateVisitsLeavesInOrder();
+
+    test_cursorEditsMatchReference();
+
+    test_snapshotKeepsOldVersion();
+
+    test_linesOfEmptyRope();
+    test_lineOffsetsMatchReference();
+    test_substringAcrossChunks();
+
+    test_buildFromUnterminatedBuffer();
+
+    test_findMatchesReference();
+    test_findAcrossManyLeaves();
+
+    test_replaceAllMatchesReference();
+    test_replaceAllKeepsSnapshot();
+
+    test_charOffsetsMatchReference();
+
+    test_toStringOfLargeRope();
+
+    test_hashDependsOnlyOnText();
+
+    test_iterSeekReadsRange();
+
+    test_applyBatchMatchesSequential();
+
+    test_deletedTextIsReclaimedLater();
+
+    test_frozenReadsMatchTree();
+
     printf("All tests ok.\n");
 }
 
@@ -401,3 +485,856 @@ static void test_growTreeFromEmptyRope() {
 
     Rope_destroy(r);
 }
+
+static void test_manyAppendsKeepOrder() {
+    const int N = 5000;
+    char expected[N + 1];
+    char c[2] = { 0, 0 };
+
+    Rope *r = Rope_new();
+    for (int i = 0; i < N; i++) {
+        c[0] = 'a' + i % 26;
+        expected[i] = c[0];
+        r = Rope_insert(r, -1, c);
+    }
+    expected[N] = '\0';
+
+    assert(Rope_size(r) == N);
+    char *s = Rope_toString(r);
+    assert(strcmp(expected, s) == 0);
+    free(s);
+
+    Rope_destroy(r);
+}
+
+static void test_randomEditsMatchReference() {
+    const int N = 3000;
+    char expected[4 * N + 1];
+    int len = 0;
+    char text[4] = "xyz";
+
+    srand(1);
+    Rope *r = Rope_new();
+    for (int i = 0; i < N; i++) {
+        if ((len > 0) && (rand() % 3 == 0)) {
+            int begin = rand() % len;
+            int end = begin + rand() % (len - begin + 1);
+            memmove(expected + begin, expected + end, len - end);
+            len -= end - begin;
+            r = Rope_delete(r, begin, end);
+        } else {
+            int pos = rand() % (len + 1);
+            int n = 1 + rand() % 3;
+            text[n] = '\0';
+            memmove(expected + pos + n, expected + pos, len - pos);
+            memcpy(expected + pos, text, n);
+            len += n;
+            r = Rope_insert(r, pos, text);
+            text[n] = "xyz"[n];
+        }
+        assert(Rope_size(r) == len);
+    }
+    expected[len] = '\0';
+
+    char *s = Rope_toString(r);
+    assert(strcmp(expected, s) == 0);
+    free(s);
+
+    Rope_destroy(r);
+}
+
+static void test_longTextSpansSeveralChunks() {
+    const int N = 5000;
+    char text[N + 1];
+    for (int i = 0; i < N; i++) text[i] = '0' + i % 10;
+    text[N] = '\0';
+
+    Rope *a = Rope_newFrom(text);
+    assert(Rope_size(a) == N);
+
+    Rope *b = Rope_split(a, 1234);
+    assert(Rope_size(a) == 1234);
+    assert(Rope_size(b) == N - 1234);
+
+    char *s = Rope_toString(b);
+    assert(strcmp(text + 1234, s) == 0);
+    free(s);
+
+    a = Rope_join(a, b);
+    s = Rope_toString(a);
+    assert(strcmp(text, s) == 0);
+    free(s);
+
+    Rope_destroy(a);
+}
+
+static void test_deleteAcrossChunks() {
+    const int N = 3000;
+    char text[N + 1];
+    for (int i = 0; i < N; i++) text[i] = 'a' + i % 26;
+    text[N] = '\0';
+
+    Rope *r = Rope_newFrom(text);
+    r = Rope_delete(r, 100, 2900);
+    assert(Rope_size(r) == 200);
+
+    char *s = Rope_toString(r);
+    assert(strncmp(text, s, 100) == 0);
+    assert(strcmp(text + 2900, s + 100) == 0);
+    free(s);
+
+    Rope_destroy(r);
+}
+
+static void test_joinRopeSharingAnotherPool() {
+    Rope *a = Rope_newFrom("Hello World!");
+    Rope *b = Rope_split(a, 6);
+    Rope *c = Rope_newFrom("Goodbye ");
+
+    /* b shares its pool with a, which is still alive. */
+    c = Rope_join(c, b);
+    Rope_destroy(a);
+
+    char *s = Rope_toString(c);
+    assert(strcmp("Goodbye World!", s) == 0);
+    free(s);
+
+    c = Rope_insert(c, 0, "Well, ");
+    s = Rope_toString(c);
+    assert(strcmp("Well, Goodbye World!", s) == 0);
+    free(s);
+
+    Rope_destroy(c);
+}
+
+static void test_iterateEmptyRope() {
+    Rope *r = Rope_new();
+    RopeIter it;
+    const char *text;
+    int len;
+
+    Rope_iterBegin(r, &it);
+    assert(Rope_iterNext(&it, &text, &len) == 0);
+
+    Rope_destroy(r);
+}
+
+static void test_iterateVisitsLeavesInOrder() {
+    const int N = 4000;
+    char expected[N + 1];
+    for (int i = 0; i < N; i++) expected[i] = 'a' + i % 26;
+    expected[N] = '\0';
+
+    Rope *r = Rope_newFrom(expected);
+    r = Rope_join(Rope_newFrom("Hello "), r);
+    r = Rope_insert(r, -1, " World");
+
+    char *s = Rope_toString(r);
+    char *p = s;
+    RopeIter it;
+    const char *text;
+    int len;
+
+    Rope_iterBegin(r, &it);
+    while (Rope_iterNext(&it, &text, &len)) {
+        assert(len > 0);
+        assert(strncmp(p, text, len) == 0);
+        p += len;
+    }
+    assert(p == s + Rope_size(r));
+    free(s);
+
+    Rope_destroy(r);
+}
+
+static void test_cursorEditsMatchReference() {
+    const int N = 20000;
+    char *expected = malloc(4 * N + 1);
+    int len = 0;
+    int pos = 0;
+    char text[4] = "abc";
+
+    srand(2);
+    Rope *r = Rope_new();
+    RopeCursor *cursor = RopeCursor_new(r);
+    for (int i = 0; i < N; i++) {
+        /* Mostly edit close to the last position, sometimes jump. */
+        pos += rand() % 9 - 4;
+        if (rand() % 50 == 0) pos = rand() % (len + 1);
+        if (pos < 0) pos = 0;
+        if (pos > len) pos = len;
+
+        if ((pos < len) && (rand() % 4 == 0)) {
+            int end = pos + 1 + rand() % ((len - pos) < 3 ? (len - pos) : 3);
+            memmove(expected + pos, expected + end, len - end);
+            len -= end - pos;
+            assert(RopeCursor_delete(cursor, pos, end) == 0);
+        } else {
+            int n = 1 + rand() % 3;
+            text[n] = '\0';
+            memmove(expected + pos + n, expected + pos, len - pos);
+            memcpy(expected + pos, text, n);
+            len += n;
+            if (rand() % 10 == 0)
+                r = Rope_insert(r, pos, text);
+            else
+                assert(RopeCursor_insert(cursor, pos, text) == 0);
+            text[n] = "abc"[n];
+        }
+        assert(Rope_size(r) == len);
+    }
+    expected[len] = '\0';
+
+    char *s = Rope_toString(r);
+    assert(strcmp(expected, s) == 0);
+    free(s);
+
+    RopeCursor_destroy(cursor);
+    Rope_destroy(r);
+    free(expected);
+}
+
+static void test_snapshotKeepsOldVersion() {
+    char text[3001];
+    for (int i = 0; i < 3000; i++) text[i] = 'a' + i % 26;
+    text[3000] = '\0';
+
+    Rope *r = Rope_newFrom(text);
+    Rope *snapshot = Rope_snapshot(r);
+    RopeCursor *cursor = RopeCursor_new(r);
+
+    r = Rope_insert(r, 1500, "xyz");
+    assert(RopeCursor_delete(cursor, 0, 700) == 0);
+    assert(RopeCursor_insert(cursor, 10, "hello") == 0);
+    RopeCursor_destroy(cursor);
+    Rope *right = Rope_split(r, 1000);
+    r = Rope_join(right, r);
+
+    char *s = Rope_toString(snapshot);
+    assert(strcmp(s, text) == 0);
+    free(s);
+    assert(Rope_size(r) == 3000 - 700 + 3 + 5);
+
+    /* Both orders of destruction leave the other version intact. */
+    Rope *again = Rope_snapshot(snapshot);
+    Rope_destroy(snapshot);
+    s = Rope_toString(again);
+    assert(strcmp(s, text) == 0);
+    free(s);
+
+    Rope_destroy(r);
+    s = Rope_toString(again);
+    assert(strcmp(s, text) == 0);
+    free(s);
+    Rope_destroy(again);
+}
+
+static void test_linesOfEmptyRope() {
+    Rope *r = Rope_new();
+    assert(Rope_lines(r) == 1);
+    assert(Rope_lineOffset(r, 0, 0) == 0);
+    assert(Rope_lineOffset(r, 0, 1) == -1);
+    assert(Rope_lineOffset(r, 1, 0) == -1);
+    assert(Rope_lineAt(r, 0) == 0);
+    Rope_destroy(r);
+}
+
+static void test_lineOffsetsMatchReference() {
+    const int N = 5000;
+    char *expected = malloc(N + 1);
+    int len = 0;
+
+    srand(3);
+    Rope *r = Rope_new();
+    RopeCursor *cursor = RopeCursor_new(r);
+    for (int i = 0; i < N; i++) {
+        int pos = rand() % (len + 1);
+        char text[2] = { rand() % 5 ? 'a' + rand() % 26 : '\n', '\0' };
+
+        memmove(expected + pos + 1, expected + pos, len - pos);
+        expected[pos] = text[0];
+        len++;
+        if (rand() % 2)
+            r = Rope_insert(r, pos, text);
+        else
+            assert(RopeCursor_insert(cursor, pos, text) == 0);
+
+        if ((i % 7 == 0) && (len > 1)) {
+            pos = rand() % (len - 1);
+            memmove(expected + pos, expected + pos + 1, len - pos - 1);
+            len--;
+            assert(RopeCursor_delete(cursor, pos, pos + 1) == 0);
+        }
+    }
+
+    /* Walk the reference text, checking both conversions at every offset. */
+    int line = 0, column = 0;
+    for (int pos = 0; pos <= len; pos++) {
+        assert(Rope_lineAt(r, pos) == line);
+        assert(Rope_lineOffset(r, line, column) == pos);
+        if ((pos < len) && (expected[pos] == '\n')) {
+            assert(Rope_lineOffset(r, line, column + 1) == -1);
+            line++;
+            column = 0;
+        } else {
+            column++;
+        }
+    }
+    assert(Rope_lines(r) == line + 1);
+    assert(Rope_lineOffset(r, line + 1, 0) == -1);
+    assert(Rope_lineAt(r, len + 1) == -1);
+
+    RopeCursor_destroy(cursor);
+    Rope_destroy(r);
+    free(expected);
+}
+
+static void test_substringAcrossChunks() {
+    char text[2001];
+    for (int i = 0; i < 2000; i++) text[i] = 'a' + i % 26;
+    text[2000] = '\0';
+    Rope *r = Rope_newFrom(text);
+
+    int ranges[][2] = { {0, 0}, {0, 2000}, {3, 7}, {500, 1500}, {511, 513},
+                        {1999, 2000} };
+    for (int i = 0; i < 6; i++) {
+        int begin = ranges[i][0], end = ranges[i][1];
+        char *s = Rope_substring(r, begin, end);
+        assert((int) strlen(s) == end - begin);
+        assert(strncmp(s, text + begin, end - begin) == 0);
+        free(s);
+    }
+    assert(Rope_substring(r, 5, 4) == NULL);
+    assert(Rope_substring(r, 0, 2001) == NULL);
+
+    Rope_destroy(r);
+}
+
+static void test_buildFromUnterminatedBuffer() {
+    const int N = 100000;
+    char *buf = malloc(N);
+    for (int i = 0; i < N; i++) buf[i] = (i % 80 == 79) ? '\n' : 'a' + i % 26;
+
+    Rope *r = Rope_buildFrom(buf, N - 1);
+    assert(Rope_size(r) == N - 1);
+    assert(Rope_lines(r) == (N - 1) / 80 + 1);
+
+    RopeIter it;
+    const char *text;
+    int len, pos = 0;
+    Rope_iterBegin(r, &it);
+    while (Rope_iterNext(&it, &text, &len)) {
+        assert(memcmp(text, buf + pos, len) == 0);
+        pos += len;
+    }
+    assert(pos == N - 1);
+    Rope_destroy(r);
+
+    r = Rope_buildFrom(buf, 0);
+    assert(Rope_size(r) == 0);
+    Rope_destroy(r);
+
+    assert(Rope_buildFrom(buf, -1) == NULL);
+    free(buf);
+}
+
+static void test_findMatchesReference() {
+    const int N = 3000;
+    char *expected = malloc(N + 1);
+    char text[2] = "a";
+
+    /* Small leaves from random inserts, over a small alphabet. */
+    srand(5);
+    Rope *r = Rope_new();
+    for (int len = 0; len < N; len++) {
+        int pos = rand() % (len + 1);
+        text[0] = 'a' + rand() % 3;
+        memmove(expected + pos + 1, expected + pos, len - pos);
+        expected[pos] = text[0];
+        r = Rope_insert(r, pos, text);
+    }
+    expected[N] = '\0';
+
+    char pattern[8];
+    for (int i = 0; i < 500; i++) {
+        int len = 1 + rand() % 7;
+        int from = rand() % (N + 1);
+        memcpy(pattern, expected + rand() % (N - len), len);
+        pattern[len] = '\0';
+
+        const char *match = strstr(expected + from, pattern);
+        assert(Rope_find(r, pattern, from) == (match ? match - expected : -1));
+    }
+
+    assert(Rope_find(r, "", 0) == -1);
+    assert(Rope_find(r, "a", N + 1) == -1);
+    assert(Rope_find(r, "x", 0) == -1);
+    Rope_destroy(r);
+    free(expected);
+}
+
+static void test_findAcrossManyLeaves() {
+    char text[3001];
+    srand(6);
+    for (int i = 0; i < 3000; i++) text[i] = 'a' + rand() % 26;
+    text[3000] = '\0';
+    Rope *r = Rope_newFrom(text);
+
+    /* A pattern longer than a chunk, starting just before a leaf ends. */
+    char pattern[1201];
+    memcpy(pattern, text + 500, 1200);
+    pattern[1200] = '\0';
+    assert(Rope_find(r, pattern, 0) == 500);
+    assert(Rope_find(r, pattern, 501) == -1);
+
+    pattern[1199] = '!';
+    assert(Rope_find(r, pattern, 0) == -1);
+
+    assert(Rope_find(r, text, 0) == 0);
+    assert(Rope_find(r, text + 2990, 0) == 2990);
+    Rope_destroy(r);
+}
+
+/* Replaces the non overlapping occurrences of from in text, into a new
+ * string. */
+static char *replaceReference(const char *text, const char *from,
+                              const char *to) {
+    int from_len = strlen(from), to_len = strlen(to);
+    char *result = malloc(strlen(text) * (to_len + 1) + 1);
+    char *dest = result;
+    const char *match;
+    while ((match = strstr(text, from))) {
+        memcpy(dest, text, match - text);
+        dest += match - text;
+        memcpy(dest, to, to_len);
+        dest += to_len;
+        text = match + from_len;
+    }
+    strcpy(dest, text);
+    return result;
+}
+
+static void test_replaceAllMatchesReference() {
+    const char *cases[][2] = {
+        { "ab", "X" }, { "a", "" }, { "b", "a long replacement text" },
+        { "abcab", "c" }, { "zzz", "y" }
+    };
+    const int N = 5000;
+    char *text = malloc(N + 1);
+
+    srand(7);
+    for (int c = 0; c < 5; c++) {
+        for (int i = 0; i < N; i++) text[i] = 'a' + rand() % 3;
+        text[N] = '\0';
+
+        /* Built from many small appends. */
+        Rope *r = Rope_new();
+        for (int i = 0; i < N; i += 7) {
+            char piece[8];
+            int n = (N - i < 7) ? N - i : 7;
+            memcpy(piece, text + i, n);
+            piece[n] = '\0';
+            r = Rope_insert(r, i, piece);
+        }
+
+        char *expected = replaceReference(text, cases[c][0], cases[c][1]);
+        int count = Rope_replaceAll(r, cases[c][0], cases[c][1]);
+        assert(count >= 0);
+
+        char *s = Rope_toString(r);
+        assert(strcmp(s, expected) == 0);
+        assert(Rope_size(r) == (int) strlen(expected));
+        assert(Rope_size(r) == N + count * ((int) strlen(cases[c][1]) -
+                                            (int) strlen(cases[c][0])));
+        free(s);
+        free(expected);
+        Rope_destroy(r);
+    }
+    free(text);
+}
+
+static void test_replaceAllKeepsSnapshot() {
+    char text[3001];
+    for (int i = 0; i < 3000; i++) text[i] = (i % 1000 == 10) ? '!' : '.';
+    text[3000] = '\0';
+
+    Rope *r = Rope_newFrom(text);
+    Rope *snapshot = Rope_snapshot(r);
+    assert(Rope_replaceAll(r, "!", "?\n") == 3);
+    assert(Rope_lines(r) == 4);
+    assert(Rope_find(r, "!", 0) == -1);
+
+    char *s = Rope_toString(snapshot);
+    assert(strcmp(s, text) == 0);
+    free(s);
+
+    Rope_destroy(snapshot);
+    assert(Rope_replaceAll(r, "?\n", "") == 3);
+    assert(Rope_size(r) == 2997);
+    Rope_destroy(r);
+}
+
+static void test_charOffsetsMatchReference() {
+    /* Characters of one to four bytes. */
+    const char *chars[] = { "a", "\xc3\xb1", "\xe2\x82\xac",
+                            "\xf0\x9f\x98\x80" };
+    const int N = 4000;
+    char *expected = malloc(4 * N + 1);
+    int *starts = malloc((N + 1) * sizeof(int));
+    int len = 0, count = 0;
+
+    srand(8);
+    Rope *r = Rope_new();
+    RopeCursor *cursor = RopeCursor_new(r);
+    for (int i = 0; i < N; i++) {
+        /* Insert at a character boundary, the way a client addressing
+         * characters would. */
+        int index = rand() % (count + 1);
+        int pos = Rope_charOffset(r, index);
+        const char *c = chars[rand() % 4];
+        int n = strlen(c);
+
+        memmove(expected + pos + n, expected + pos, len - pos);
+        memcpy(expected + pos, c, n);
+        len += n;
+        count++;
+        if (rand() % 2)
+            r = Rope_insert(r, pos, c);
+        else
+            assert(RopeCursor_insert(cursor, pos, c) == 0);
+
+        if (i % 5 == 0) {
+            index = rand() % count;
+            int begin = Rope_charOffset(r, index);
+            int end = Rope_charOffset(r, index + 1);
+            memmove(expected + begin, expected + end, len - end);
+            len -= end - begin;
+            count--;
+            assert(RopeCursor_delete(cursor, begin, end) == 0);
+        }
+    }
+
+    /* Where every character starts, from the reference text. */
+    int n = 0;
+    for (int pos = 0; pos < len; pos++)
+        if (((unsigned char) expected[pos] & 0xc0) != 0x80) starts[n++] = pos;
+    starts[n] = len;
+
+    assert(Rope_chars(r) == count);
+    assert(n == count);
+    for (int i = 0; i <= count; i++) {
+        assert(Rope_charOffset(r, i) == starts[i]);
+        assert(Rope_charIndex(r, starts[i]) == i);
+    }
+    assert(Rope_charOffset(r, count + 1) == -1);
+    assert(Rope_charIndex(r, len + 1) == -1);
+
+    RopeCursor_destroy(cursor);
+    Rope_destroy(r);
+    free(starts);
+    free(expected);
+}
+
+static void test_toStringOfLargeRope() {
+    /* Big enough to be copied by several threads. */
+    const int N = 9 << 20;
+    char *expected = malloc(N + 1);
+    int len = N - 1000;
+
+    srand(9);
+    for (int i = 0; i < len; i++) expected[i] = 'a' + rand() % 26;
+    Rope *r = Rope_buildFrom(expected, len);
+    assert(r);
+
+    /* Leaves of uneven lengths, scattered over the rope. */
+    for (int i = 0; i < 100; i++) {
+        int pos = rand() % (len + 1);
+        memmove(expected + pos + 10, expected + pos, len - pos);
+        memcpy(expected + pos, "0123456789", 10);
+        len += 10;
+        r = Rope_insert(r, pos, "0123456789");
+    }
+    expected[len] = '\0';
+
+    char *s = Rope_toString(r);
+    assert(strcmp(s, expected) == 0);
+
+    free(s);
+    Rope_destroy(r);
+    free(expected);
+}
+
+static void test_hashDependsOnlyOnText() {
+    const int N = 3000;
+    char *expected = malloc(N * 8 + 1);
+    int len = 0;
+
+    /* Edited through every path, so the tree has nothing in common with the
+     * one Rope_newFrom builds for the same text. */
+    srand(10);
+    Rope *r = Rope_new();
+    RopeCursor *cursor = RopeCursor_new(r);
+    for (int i = 0; i < N; i++) {
+        char text[8];
+        int n = 1 + rand() % 7;
+        for (int j = 0; j < n; j++) text[j] = 'a' + rand() % 3;
+        text[n] = '\0';
+
+        int pos = rand() % (len + 1);
+        memmove(expected + pos + n, expected + pos, len - pos);
+        memcpy(expected + pos, text, n);
+        len += n;
+        if (i % 2)
+            r = Rope_insert(r, pos, text);
+        else
+            assert(RopeCursor_insert(cursor, pos, text) == 0);
+
+        if (i % 3 == 0) {
+            int begin = rand() % len;
+            int end = begin + rand() % (len - begin < 4 ? len - begin : 4);
+            memmove(expected + begin, expected + end, len - end);
+            len -= end - begin;
+            assert(RopeCursor_delete(cursor, begin, end) == 0);
+        }
+    }
+    expected[len] = '\0';
+
+    Rope *same = Rope_newFrom(expected);
+    uint64_t hash, other;
+    assert(Rope_hash(r, 0, len, &hash) == 0);
+    assert(Rope_hash(same, 0, len, &other) == 0);
+    assert(hash == other);
+
+    /* Ranges hash as ropes holding only their text. */
+    for (int i = 0; i < 200; i++) {
+        int begin = rand() % (len + 1);
+        int end = begin + rand() % (len - begin + 1);
+        char saved = expected[end];
+        expected[end] = '\0';
+        Rope *range = Rope_newFrom(expected + begin);
+        expected[end] = saved;
+
+        assert(Rope_hash(r, begin, end, &hash) == 0);
+        assert(Rope_hash(range, 0, end - begin, &other) == 0);
+        assert(hash == other);
+        Rope_destroy(range);
+    }
+
+    /* Changing a single byte changes the hash. */
+    assert(Rope_hash(r, 0, len, &hash) == 0);
+    assert(RopeCursor_delete(cursor, len / 2, len / 2 + 1) == 0);
+    assert(RopeCursor_insert(cursor, len / 2, "z") == 0);
+    assert(Rope_hash(r, 0, len, &other) == 0);
+    assert(hash != other);
+    assert(Rope_hash(r, 0, len + 1, &other) == -1);
+
+    RopeCursor_destroy(cursor);
+    Rope_destroy(same);
+    Rope_destroy(r);
+    free(expected);
+}
+
+static void test_iterSeekReadsRange() {
+    const int N = 20000;
+    char *expected = malloc(N + 1);
+    char *read = malloc(N + 1);
+    for (int i = 0; i < N; i++) expected[i] = 'a' + i % 26;
+    expected[N] = '\0';
+
+    Rope *r = Rope_buildFrom(expected, N);
+    for (int i = 0; i < 100; i++) {
+        int pos = rand() % (N + 1);
+        char text[2] = { expected[pos], '\0' };
+        r = Rope_delete(r, pos, pos + (pos < N));
+        r = Rope_insert(r, pos, text);
+    }
+
+    for (int i = 0; i < 500; i++) {
+        int begin = rand() % (N + 1);
+        int end = begin + rand() % (N - begin + 1);
+
+        /* Read leaves from the one holding begin until end is covered. */
+        RopeIter it;
+        const char *text;
+        int len;
+        int skip = Rope_iterSeek(r, &it, begin);
+        int n = 0;
+        assert(skip >= 0);
+        while ((n < end - begin) && Rope_iterNext(&it, &text, &len)) {
+            int take = len - skip;
+            if (take > end - begin - n) take = end - begin - n;
+            memcpy(read + n, text + skip, take);
+            n += take;
+            skip = 0;
+        }
+        assert(n == end - begin);
+        assert(memcmp(read, expected + begin, n) == 0);
+    }
+
+    RopeIter it;
+    assert(Rope_iterSeek(r, &it, N + 1) == -1);
+    assert(Rope_iterSeek(r, &it, -1) == -1);
+
+    Rope_destroy(r);
+    free(read);
+    free(expected);
+}
+
+static void test_applyBatchMatchesSequential() {
+    const char *texts[] = { "", "x", "yz", "0123456789" };
+    char expected[4096];
+    RopeEdit edits[40];
+
+    srand(11);
+    for (int round = 0; round < 500; round++) {
+        /* Documents small enough that edits often overlap and touch, and big
+         * enough to span a few leaves now and then. */
+        int len = rand() % 1500;
+        for (int i = 0; i < len; i++) expected[i] = 'a' + rand() % 26;
+        expected[len] = '\0';
+        Rope *r = Rope_newFrom(expected);
+
+        int n = 1 + rand() % 40;
+        int applied = 0;
+        for (int i = 0; i < n; i++) {
+            /* A few edits are out of range, and a few count from the end. */
+            int begin = rand() % (len + 3) - 1;
+            int end = begin + rand() % 6;
+            const char *text = texts[rand() % 4];
+            edits[i] = (RopeEdit) { .begin = begin, .end = end, .text = text };
+
+            if (begin < 0) begin += len + 1;
+            if (end < 0) end += len + 1;
+            if ((begin < 0) || (begin > end) || (end > len)) continue;
+
+            int text_len = strlen(text);
+            memmove(expected + begin + text_len, expected + end,
+                    len - end + 1);
+            memcpy(expected + begin, text, text_len);
+            len += text_len - (end - begin);
+            applied++;
+        }
+
+        assert(Rope_applyBatch(r, edits, n) == applied);
+        assert(Rope_size(r) == len);
+        char *s = Rope_toString(r);
+        assert(strcmp(s, expected) == 0);
+
+        free(s);
+        Rope_destroy(r);
+    }
+}
+
+static void test_deletedTextIsReclaimedLater() {
+    const int N = 1 << 20;
+    char *text = malloc(N + 1);
+    for (int i = 0; i < N; i++) text[i] = 'a' + i % 26;
+    text[N] = '\0';
+
+    Rope *r = Rope_newFrom(text);
+    Rope *snapshot = Rope_snapshot(r);
+    assert(Rope_reclaim(r, 16) == 0);
+
+    /* The snapshot still holds the text, so only the nodes copied on the
+     * way to the range are given back. */
+    assert(Rope_delete(r, 0, N) == r);
+    assert(Rope_size(r) == 0);
+    while (Rope_reclaim(r, 16) == 16);
+    char *s = Rope_toString(snapshot);
+    assert(strcmp(s, text) == 0);
+    free(s);
+
+    /* Without it, the whole tree is given back, a slice at a time. */
+    Rope_destroy(snapshot);
+    assert(Rope_reclaim(r, 16) == 16);
+    int freed = 16, slice;
+    while ((slice = Rope_reclaim(r, 1000)) == 1000) freed += slice;
+    freed += slice;
+    assert(freed == 2 * (N / 512) - 1);
+
+    /* The middle of a rope, while the rest stays in use. */
+    r = Rope_join(r, Rope_newFrom(text));
+    assert(Rope_delete(r, 1000, N - 1000) == r);
+    assert(Rope_insert(r, 1000, "xyz") == r);
+    while (Rope_reclaim(r, 1000) == 1000);
+
+    s = Rope_toString(r);
+    assert(strncmp(s, text, 1000) == 0);
+    assert(strncmp(s + 1000, "xyz", 3) == 0);
+    assert(strcmp(s + 1003, text + N - 1000) == 0);
+    free(s);
+
+    Rope_destroy(r);
+    free(text);
+}
+
+static void test_frozenReadsMatchTree() {
+    const int N = 200000;
+    char *text = malloc(N + 1);
+    srand(21);
+    for (int i = 0; i < N; i++)
+        text[i] = (rand() % 40 == 0) ? '\n' : 'a' + rand() % 4;
+    text[N] = '\0';
+
+    /* The snapshot shares the tree, but is read from it. */
+    Rope *r = Rope_newFrom(text);
+    Rope *tree = Rope_snapshot(r);
+    assert(Rope_freeze(r) == 0);
+    assert(Rope_freeze(r) == 0);
+
+    for (int pos = -1; pos <= N + 1; pos++)
+        assert(Rope_lineAt(r, pos) == Rope_lineAt(tree, pos));
+    for (int line = -1; line <= Rope_lines(r); line++)
+        for (int column = 0; column < 60; column += 7)
+            assert(Rope_lineOffset(r, line, column) ==
+                   Rope_lineOffset(tree, line, column));
+
+    for (int i = 0; i < 1000; i++) {
+        int begin = rand() % (N + 1);
+        int end = begin + rand() % (N + 1 - begin);
+        char *a = Rope_substring(r, begin, end);
+        char *b = Rope_substring(tree, begin, end);
+        assert(strcmp(a, b) == 0);
+        free(a);
+        free(b);
+
+        char pattern[] = { 'a' + rand() % 4, 'a' + rand() % 4, '\n',
+                           'a' + rand() % 4, '\0' };
+        assert(Rope_find(r, pattern, begin) ==
+               Rope_find(tree, pattern, begin));
+    }
+
+    RopeIter it;
+    const char *chunk;
+    int len;
+    assert(Rope_iterSeek(r, &it, 1234) == 1234);
+    assert(Rope_iterNext(&it, &chunk, &len) == 1);
+    assert((len == N) && (memcmp(chunk, text, N) == 0));
+    assert(Rope_iterNext(&it, &chunk, &len) == 0);
+
+    char *s = Rope_toString(r);
+    assert(strcmp(s, text) == 0);
+    free(s);
+
+    /* An edit drops the flat layout, and reads go back to the tree. */
+    assert(Rope_insert(r, 10, "\n\n") == r);
+    assert(Rope_insert(tree, 10, "\n\n") == tree);
+    for (int pos = 0; pos <= N + 2; pos += 97)
+        assert(Rope_lineAt(r, pos) == Rope_lineAt(tree, pos));
+    Rope_iterBegin(r, &it);
+    assert(Rope_iterNext(&it, &chunk, &len) && (len < N));
+
+    Rope_destroy(tree);
+    Rope_destroy(r);
+
+    /* The empty rope has one line, and nothing to iterate over. */
+    r = Rope_new();
+    assert(Rope_freeze(r) == 0);
+    assert(Rope_lineAt(r, 0) == 0);
+    assert(Rope_lineOffset(r, 0, 0) == 0);
+    Rope_iterBegin(r, &it);
+    assert(Rope_iterNext(&it, &chunk, &len) == 0);
+    Rope_destroy(r);
+
+    free(text);
+}
@@ -1,2 +1,7 @@
-gcc UNIT_bintree.c ../src/bintree.o -ggdb -o "TEST_bintree"
-gcc UNIT_rope.c ../src/bintree.o ../src/rope.o -ggdb -o "TEST_rope"
+gcc UNIT_pool.c ../src/pool.o -ggdb -o "TEST_pool"
+gcc UNIT_rope.c ../src/pool.o ../src/rope.o -ggdb -pthread -o "TEST_rope"
+gcc UNIT_piecetable.c ../src/pool.o ../src/piecetable.o -ggdb -o "TEST_piecetable"
+gcc UNIT_btreerope.c ../src/pool.o ../src/btreerope.o -ggdb -o "TEST_btreerope"
+gcc UNIT_delta.c ../src/pool.o ../src/rope.o ../src/delta.o -ggdb -pthread -o "TEST_delta"
+gcc UNIT_courier.c ../src/socket.o ../src/courier.o -ggdb -pthread -o "TEST_courier"
+gcc BENCH_rope.c ../src/pool.o ../src/rope.o ../src/piecetable.o ../src/btreerope.o -O2 -pthread -o "BENCH_rope"